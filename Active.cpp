@@ -0,0 +1,147 @@
+#include "Sim.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <vector>
+
+// the active engine runs the serial sweep over a list of the grains that might still move instead
+// of over the grid. the list is sorted by cell index, which is the serial order (rows bottom-up,
+// cells left to right), so the result is exactly the same as a full scan.
+//
+// a grain that can't move stays stuck until one of the three cells under it is emptied, so:
+//   a grain that moved, or was placed, is listed for the next tick
+//   a grain that couldn't move stays listed for ACTIVE_SLEEP_TICKS ticks, then drops out
+//   emptying a cell lists the grains in the three cells above it
+// the emptied cell's row is being swept, the cells above come later in the same tick, so woken
+// grains go into a min-heap that is merged with the sorted list as the sweep goes.
+// indices are 32 bits, so updateSimulation runs serial instead on worlds of more than 4G cells
+
+static std::vector<uint32_t> activeCells;
+static std::vector<uint32_t> nextCells;
+static std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> wokenCells;
+static bool stepping = false;
+
+//activeState is 0 for cells that aren't listed, otherwise 1 + the ticks the grain has been stuck
+static inline void listCell(size_t index, bool now) {
+    if (grid.activeState[index] == 0) {
+        if (now) {
+            wokenCells.push((uint32_t)index);
+        }
+        else {
+            nextCells.push_back((uint32_t)index);
+        }
+    }
+    grid.activeState[index] = 1;
+}
+
+void listActiveCell(int x, int y) {
+    listCell(cellIndex(x, y), false);
+}
+
+void wakeActiveAbove(int x, int y) {
+    if (y + 1 >= grid.height) {
+        return;
+    }
+    for (int wakeX = std::max(x - 1, 0); wakeX <= std::min(x + 1, grid.width - 1); ++wakeX) {
+        size_t index = cellIndex(wakeX, y + 1);
+        if (grid.type[index] != EMPTY) {
+            listCell(index, stepping);
+        }
+    }
+}
+
+//column the grain at (x, y) would move to, or -1 if it is stuck
+static inline int findMove(size_t index, int x, int y) {
+    if (y == 0) {
+        return -1;
+    }
+    const uint8_t* below = grid.type + index - grid.width;
+    if (below[0] == EMPTY) {
+        return x;
+    }
+    else if (x > 0 && below[-1] == EMPTY) {
+        return x - 1;
+    }
+    else if (x < grid.width - 1 && below[1] == EMPTY) {
+        return x + 1;
+    }
+    return -1;
+}
+
+//only grains that can move right now are listed, a stuck one gets woken when the cells under it change
+void rebuildActiveList() {
+    std::memset(grid.activeState, 0, (size_t)grid.width * grid.height);
+    nextCells.clear();
+    for (int y = 0; y < grid.height; ++y) {
+        const uint8_t* types = typeRow(y);
+        for (int x = 0; x < grid.width; ++x) {
+            if (types[x] != EMPTY && findMove(cellIndex(x, y), x, y) >= 0) {
+                listCell(cellIndex(x, y), false);
+            }
+        }
+    }
+    grid.activeValid = true;
+}
+
+static inline void stepCell(uint32_t index) {
+    uint8_t& state = grid.activeState[index];
+    if (grid.type[index] == EMPTY) {
+        state = 0;
+        return;
+    }
+    int x = (int)(index % grid.width);
+    int y = (int)(index / grid.width);
+
+    int toX = findMove(index, x, y);
+    if (toX < 0) {
+        if (state >= ACTIVE_SLEEP_TICKS) {
+            state = 0;
+        }
+        else {
+            ++state;
+            nextCells.push_back(index);
+        }
+        return;
+    }
+
+    size_t to = cellIndex(toX, y - 1);
+    grid.type[to] = grid.type[index];
+    grid.color[to] = grid.color[index];
+    grid.type[index] = EMPTY;
+    grid.color[index] = 0;
+    paintCells(std::min(x, toX), y - 1, std::max(x, toX), y);
+    state = 0;
+    listCell(to, false);
+    wakeActiveAbove(x, y);
+}
+
+void updateActive() {
+    if (!grid.activeValid) {
+        rebuildActiveList();
+    }
+
+    activeCells.swap(nextCells);
+    nextCells.clear();
+    //mostly sorted already, grains that moved only shift back by about a row
+    std::sort(activeCells.begin(), activeCells.end());
+
+    stepping = true;
+    size_t next = 0;
+    while (next < activeCells.size() || !wokenCells.empty()) {
+        if (wokenCells.empty() || (next < activeCells.size() && activeCells[next] < wokenCells.top())) {
+            stepCell(activeCells[next++]);
+        }
+        else {
+            uint32_t index = wokenCells.top();
+            wokenCells.pop();
+            stepCell(index);
+        }
+    }
+    stepping = false;
+}
+
+int countActiveCells() {
+    return grid.activeValid ? (int)nextCells.size() : 0;
+}
@@ -0,0 +1,412 @@
+#include "Sim.h"
+#include "Scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// repeatable benchmarks of the simulation and the cpu side of drawing it:
+//   sand_bench [--ticks n] [--size WxH] [--repeat n] [--scene name] [--engine name]
+//              [--json out.json] [--baseline saved.json] [--tolerance percent]
+//
+// every scene is built in code from a fixed seed, so a run is the same world tick for tick on
+// every machine and the final hashes can be compared as well as the times.
+//   empty     nothing at all, the cost of a tick that has nothing to do
+//   stream    one source in the middle of the top row
+//   rain      a source on every fourth column of the top row
+//   pile      settled sand piles (45 degree slopes) with a trickle landing on the biggest one
+//   noise     a third of the cells filled at random, all falling at once
+// for each scene and engine it reports
+//   cell updates/s    cells in the world times ticks, over the time spent in updateSimulation
+//   ns/active         time in updateSimulation over the active particles, grains that had an
+//                     empty cell under them or diagonally under them when the tick started
+//   instance build    building renderGrid's 8-byte instances for every filled cell, once a tick
+//   painted upload    copying the painted rects into a texture sized buffer, like the texture path
+// --json writes the results out, --baseline compares against a file written that way and exits
+// with 1 if anything got slower than --tolerance (10% by default) or a hash changed. the baseline
+// has to be from the same --size and --ticks, nothing in it compares with another run's
+
+// laid out like the instances Render.cpp streams to the gpu
+struct BenchInstance {
+    uint16_t x, y;
+    uint32_t color;
+};
+
+struct BenchScene {
+    const char* name;
+    void (*build)(Scene& scene);
+};
+
+struct BenchResult {
+    std::string scene;
+    std::string engine;
+    int fallbackTicks = 0;  // ticks the engine left to serial, the world had more than it takes
+    double simSeconds = 0.0;
+    double cellUpdatesPerSecond = 0.0;
+    double activePerTick = 0.0;
+    double nsPerActive = 0.0;
+    double instanceBuildMs = 0.0;
+    double instanceBytes = 0.0;
+    double paintedUploadMs = 0.0;
+    double paintedBytes = 0.0;
+    uint64_t hash = 0;
+};
+
+static uint32_t benchColor(float r, float g, float b) {
+    return packColor(glm::vec4(r, g, b, 1.0f));
+}
+
+static void buildEmpty(Scene&) {
+}
+
+static void buildStream(Scene& scene) {
+    scene.sources.push_back({ grid.width / 2, grid.height - 1, SAND, benchColor(0.9f, 0.75f, 0.4f) });
+}
+
+static void buildRain(Scene& scene) {
+    for (int x = 0; x < grid.width; x += 4) {
+        float shade = (float)x / grid.width;
+        scene.sources.push_back({ x, grid.height - 1, SAND, benchColor(0.3f + 0.6f * shade, 0.5f, 0.9f - 0.6f * shade) });
+    }
+}
+
+//a grain on a 45 degree slope always has the cell diagonally under it filled, so these never move
+static void fillPile(int centerX, int halfBase, uint32_t color) {
+    for (int y = 0; y <= halfBase; ++y) {
+        fillSpan(centerX - halfBase + y, centerX + halfBase - y, y, SAND, color);
+    }
+}
+
+static void buildPile(Scene& scene) {
+    fillPile(grid.width / 2, grid.width / 4, benchColor(0.9f, 0.75f, 0.4f));
+    fillPile(grid.width / 8, grid.width / 10, benchColor(0.8f, 0.6f, 0.3f));
+    fillPile(grid.width * 7 / 8, grid.width / 10, benchColor(0.8f, 0.6f, 0.3f));
+    scene.sources.push_back({ grid.width / 2, grid.height - 1, SAND, benchColor(0.8f, 0.3f, 0.2f) });
+}
+
+static void buildNoise(Scene&) {
+    std::mt19937 gen(20240825);
+    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+    for (int y = 0; y < grid.height; ++y) {
+        for (int x = 0; x < grid.width; ++x) {
+            if (dis(gen) < 1.0f / 3.0f) {
+                setCell(x, y, SAND, benchColor(dis(gen), dis(gen), dis(gen)));
+            }
+        }
+    }
+}
+
+static const BenchScene SCENES[] = {
+    { "empty", buildEmpty },
+    { "stream", buildStream },
+    { "rain", buildRain },
+    { "pile", buildPile },
+    { "noise", buildNoise },
+};
+
+static int countActiveParticles() {
+    int count = 0;
+    for (int y = 1; y < grid.height; ++y) {
+        const uint8_t* types = typeRow(y);
+        const uint8_t* below = typeRow(y - 1);
+        for (int x = 0; x < grid.width; ++x) {
+            if (types[x] != EMPTY && (below[x] == EMPTY || (x > 0 && below[x - 1] == EMPTY) ||
+                (x + 1 < grid.width && below[x + 1] == EMPTY))) {
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static BenchResult runBench(const BenchScene& benchScene, SimEngine engine, int width, int height, int ticks) {
+    using namespace std::chrono;
+    resizeGrid(width, height);
+    simEngine = engine;
+    Scene scene;
+    benchScene.build(scene);
+
+    size_t cells = (size_t)width * height;
+    std::vector<BenchInstance> instances(cells);
+    std::vector<uint32_t> texture(cells);
+    std::vector<DirtyRect> rects;
+    //the world as built is the first upload, not part of any tick
+    takePaintedRects(rects);
+
+    BenchResult result;
+    result.scene = benchScene.name;
+    result.engine = ENGINE_NAMES[engine];
+    double buildSeconds = 0.0, uploadSeconds = 0.0;
+    long long active = 0;
+    for (int tick = 0; tick < ticks; ++tick) {
+        applySceneSources(scene);
+        active += countActiveParticles();
+
+        auto start = steady_clock::now();
+        updateSimulation();
+        result.simSeconds += secondsSince(start);
+        result.fallbackTicks += steppedEngine != engine;
+
+        start = steady_clock::now();
+        size_t count = 0;
+        for (int y = 0; y < height; ++y) {
+            const uint8_t* types = typeRow(y);
+            const uint32_t* colors = colorRow(y);
+            for (int x = 0; x < width; ++x) {
+                if (types[x] != EMPTY) {
+                    instances[count++] = { (uint16_t)x, (uint16_t)y, colors[x] };
+                }
+            }
+        }
+        buildSeconds += secondsSince(start);
+        result.instanceBytes += (double)count * sizeof(BenchInstance);
+
+        start = steady_clock::now();
+        takePaintedRects(rects);
+        for (const DirtyRect& rect : rects) {
+            size_t rowBytes = (size_t)(rect.maxX - rect.minX + 1) * sizeof(uint32_t);
+            for (int y = rect.minY; y <= rect.maxY; ++y) {
+                std::memcpy(texture.data() + cellIndex(rect.minX, y), colorRow(y) + rect.minX, rowBytes);
+            }
+            result.paintedBytes += (double)rowBytes * (rect.maxY - rect.minY + 1);
+        }
+        uploadSeconds += secondsSince(start);
+    }
+
+    result.cellUpdatesPerSecond = result.simSeconds > 0.0 ? (double)cells * ticks / result.simSeconds : 0.0;
+    result.activePerTick = (double)active / ticks;
+    result.nsPerActive = active > 0 ? result.simSeconds * 1.0e9 / active : 0.0;
+    result.instanceBuildMs = buildSeconds * 1000.0 / ticks;
+    result.instanceBytes /= ticks;
+    result.paintedUploadMs = uploadSeconds * 1000.0 / ticks;
+    result.paintedBytes /= ticks;
+    result.hash = gridHash();
+    return result;
+}
+
+static bool writeJson(const char* path, const std::vector<BenchResult>& results, int width, int height, int ticks) {
+    std::FILE* file = std::fopen(path, "w");
+    if (!file) {
+        std::fprintf(stderr, "could not write %s\n", path);
+        return false;
+    }
+    std::fprintf(file, "{\n  \"size\": \"%dx%d\",\n  \"ticks\": %d,\n  \"results\": [\n", width, height, ticks);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        std::fprintf(file,
+            "    {\"scene\": \"%s\", \"engine\": \"%s\", \"fallback_ticks\": %d, \"sim_seconds\": %.6f, \"cell_updates_per_s\": %.6e, "
+            "\"active_per_tick\": %.1f, \"ns_per_active\": %.3f, \"instance_build_ms\": %.4f, \"instance_bytes\": %.0f, "
+            "\"painted_upload_ms\": %.4f, \"painted_bytes\": %.0f, \"hash\": \"%016llx\"}%s\n",
+            r.scene.c_str(), r.engine.c_str(), r.fallbackTicks, r.simSeconds, r.cellUpdatesPerSecond, r.activePerTick, r.nsPerActive,
+            r.instanceBuildMs, r.instanceBytes, r.paintedUploadMs, r.paintedBytes, (unsigned long long)r.hash,
+            i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    std::fclose(file);
+    return true;
+}
+
+//the value after "key": in one result object, as text. only has to read what writeJson writes
+static std::string jsonField(const std::string& object, const char* key) {
+    std::string quoted = std::string("\"") + key + "\":";
+    size_t at = object.find(quoted);
+    if (at == std::string::npos) {
+        return "";
+    }
+    at = object.find_first_not_of(" \"", at + quoted.size());
+    size_t end = object.find_first_of(",\"}", at);
+    return object.substr(at, end - at);
+}
+
+static bool readJson(const char* path, std::vector<BenchResult>& results, int& width, int& height, int& ticks) {
+    std::ifstream file(path);
+    if (!file) {
+        std::fprintf(stderr, "could not open baseline %s\n", path);
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string text = buffer.str();
+    size_t at = text.find('[');
+    //the run's size and ticks come before the results
+    std::string header = text.substr(0, at);
+    if (std::sscanf(jsonField(header, "size").c_str(), "%dx%d", &width, &height) != 2) {
+        width = height = 0;
+    }
+    ticks = std::atoi(jsonField(header, "ticks").c_str());
+    while (at != std::string::npos && (at = text.find('{', at)) != std::string::npos) {
+        size_t end = text.find('}', at);
+        if (end == std::string::npos) {
+            break;
+        }
+        std::string object = text.substr(at, end - at + 1);
+        BenchResult r;
+        r.scene = jsonField(object, "scene");
+        r.engine = jsonField(object, "engine");
+        r.cellUpdatesPerSecond = std::atof(jsonField(object, "cell_updates_per_s").c_str());
+        r.instanceBuildMs = std::atof(jsonField(object, "instance_build_ms").c_str());
+        r.paintedUploadMs = std::atof(jsonField(object, "painted_upload_ms").c_str());
+        r.hash = std::strtoull(jsonField(object, "hash").c_str(), nullptr, 16);
+        results.push_back(r);
+        at = end;
+    }
+    return true;
+}
+
+//percent change of a rate, positive is faster
+static double speedup(double now, double before) {
+    return before > 0.0 ? (now / before - 1.0) * 100.0 : 0.0;
+}
+
+//percent change of a time, positive is faster
+static double timeSaved(double now, double before) {
+    return now > 0.0 ? (before / now - 1.0) * 100.0 : 0.0;
+}
+
+//prints the changes against the baseline, false if anything regressed past the tolerance
+static bool compareBaseline(const std::vector<BenchResult>& results, const std::vector<BenchResult>& baseline, double tolerance) {
+    bool ok = true;
+    std::printf("\nagainst the baseline (positive is faster):\n");
+    std::printf("%-8s %-9s %10s %10s %10s\n", "scene", "engine", "sim", "instances", "painted");
+    for (const BenchResult& r : results) {
+        auto match = std::find_if(baseline.begin(), baseline.end(), [&](const BenchResult& b) {
+            return b.scene == r.scene && b.engine == r.engine;
+        });
+        if (match == baseline.end()) {
+            std::printf("%-8s %-9s not in the baseline\n", r.scene.c_str(), r.engine.c_str());
+            continue;
+        }
+        double sim = speedup(r.cellUpdatesPerSecond, match->cellUpdatesPerSecond);
+        double build = timeSaved(r.instanceBuildMs, match->instanceBuildMs);
+        double painted = timeSaved(r.paintedUploadMs, match->paintedUploadMs);
+        bool slower = sim < -tolerance || build < -tolerance || painted < -tolerance;
+        bool changed = r.hash != match->hash;
+        std::printf("%-8s %-9s %+9.1f%% %+9.1f%% %+9.1f%%%s%s\n", r.scene.c_str(), r.engine.c_str(), sim, build, painted,
+            slower ? "  slower" : "", changed ? "  hash changed" : "");
+        ok = ok && !slower && !changed;
+    }
+    return ok;
+}
+
+static void keepBest(BenchResult& best, const BenchResult& run) {
+    if (run.simSeconds < best.simSeconds) {
+        best.simSeconds = run.simSeconds;
+        best.cellUpdatesPerSecond = run.cellUpdatesPerSecond;
+        best.nsPerActive = run.nsPerActive;
+    }
+    best.instanceBuildMs = std::min(best.instanceBuildMs, run.instanceBuildMs);
+    best.paintedUploadMs = std::min(best.paintedUploadMs, run.paintedUploadMs);
+}
+
+int main(int argc, char** argv) {
+    int ticks = 500;
+    int width = 512, height = 512;
+    int repeat = 1;
+    double tolerance = 10.0;
+    const char* onlyScene = nullptr;
+    const char* onlyEngine = nullptr;
+    const char* jsonPath = nullptr;
+    const char* baselinePath = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            ticks = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                std::fprintf(stderr, "bad size '%s', expected WxH\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            onlyScene = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            onlyEngine = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = std::atof(argv[++i]);
+        }
+        else {
+            std::fprintf(stderr, "usage: %s [--ticks n] [--size WxH] [--repeat n] [--scene name] [--engine name] "
+                "[--json out.json] [--baseline saved.json] [--tolerance percent]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (width > MAX_GRID_SIDE || height > MAX_GRID_SIDE) {
+        std::fprintf(stderr, "instances only have 16 bits per coordinate, worlds go up to %d cells a side\n", MAX_GRID_SIDE);
+        return 1;
+    }
+
+    std::vector<BenchResult> baseline;
+    if (baselinePath) {
+        int baselineWidth, baselineHeight, baselineTicks;
+        if (!readJson(baselinePath, baseline, baselineWidth, baselineHeight, baselineTicks)) {
+            return 1;
+        }
+        if (baselineWidth != width || baselineHeight != height || baselineTicks != ticks) {
+            std::fprintf(stderr, "the baseline ran %dx%d for %d ticks, not %dx%d for %d, its numbers and hashes don't compare\n",
+                baselineWidth, baselineHeight, baselineTicks, width, height, ticks);
+            return 1;
+        }
+    }
+
+    std::printf("%dx%d, %d ticks, best of %d\n", width, height, ticks, repeat);
+    std::printf("%-8s %-9s %12s %10s %10s %12s %12s %16s\n", "scene", "engine", "cells/s", "active", "ns/active",
+        "instances ms", "painted ms", "hash");
+    std::vector<BenchResult> results;
+    for (const BenchScene& scene : SCENES) {
+        if (onlyScene && std::strcmp(onlyScene, scene.name) != 0) {
+            continue;
+        }
+        for (int engine = 0; engine < ENGINE_COUNT; ++engine) {
+            if (onlyEngine && std::strcmp(onlyEngine, ENGINE_NAMES[engine]) != 0) {
+                continue;
+            }
+            BenchResult best = runBench(scene, (SimEngine)engine, width, height, ticks);
+            for (int run = 1; run < repeat; ++run) {
+                keepBest(best, runBench(scene, (SimEngine)engine, width, height, ticks));
+            }
+            std::printf("%-8s %-9s %12.3e %10.0f %10.2f %12.4f %12.4f %016llx", best.scene.c_str(), best.engine.c_str(),
+                best.cellUpdatesPerSecond, best.activePerTick, best.nsPerActive, best.instanceBuildMs, best.paintedUploadMs,
+                (unsigned long long)best.hash);
+            if (best.fallbackTicks > 0) {
+                std::printf("  ran serial for %d of %d ticks", best.fallbackTicks, ticks);
+            }
+            std::printf("\n");
+            results.push_back(best);
+        }
+    }
+    if (results.empty()) {
+        std::fprintf(stderr, "no scene or engine by that name\n");
+        return 1;
+    }
+
+    if (jsonPath && !writeJson(jsonPath, results, width, height, ticks)) {
+        return 1;
+    }
+    if (baselinePath && !compareBaseline(results, baseline, tolerance)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include "Sim.h"
+
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// the bitboard engine runs the serial sweep (rows bottom-up, cells left to right, straight down
+// before down-left before down-right) on the occupancy bits, a 64-cell word at a time.
+//
+// a grain's choice only depends on the row under it, and grains earlier in the same row can
+// only change that row by filling cells. going through the row left to right, the cell down-left
+// of grain x is always full once x-1 has been handled if x-1 holds a grain, so with
+//   S = grains in the row, B = row below, L = cell down-left of each bit, R = cell down-right
+//   fall = S & ~B
+//   left = S & B & ~L          where L = (B | S) shifted up one column
+//   right = S & B & L & ~R
+// as long as nothing goes down-right. a grain that does go down-right fills the cell the next
+// grain wanted to fall into, which can chain along the row, so words with any right moves are
+// stepped one cell at a time instead. words are stepped left to right and write straight into
+// the row below, so a move across a word boundary is already in place for the next word.
+// colors and the type plane follow the moves in a second pass over the move masks
+
+static inline int lowestBit(uint64_t v) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return (int)index;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+static inline void movePlanes(int x, int y, int toX, int toY) {
+    size_t from = cellIndex(x, y);
+    size_t to = cellIndex(toX, toY);
+    grid.type[to] = grid.type[from];
+    grid.color[to] = grid.color[from];
+    grid.type[from] = EMPTY;
+    grid.color[from] = 0;
+}
+
+//bits past the grid width in the last word of a row
+static inline uint64_t validMask(int word) {
+    int valid = grid.width - word * 64;
+    return valid >= 64 ? ~0ull : (1ull << valid) - 1;
+}
+
+static inline bool occupied(const uint64_t* row, int x) {
+    return (row[x >> 6] >> (x & 63)) & 1;
+}
+
+static inline void setOccupied(uint64_t* row, int x) {
+    row[x >> 6] |= 1ull << (x & 63);
+}
+
+void rebuildOccupancy() {
+    std::memset(grid.occupancy, 0, (size_t)grid.height * grid.occupancyWords * sizeof(uint64_t));
+    for (int y = 0; y < grid.height; ++y) {
+        const uint8_t* types = typeRow(y);
+        uint64_t* bits = occupancyRow(y);
+        for (int x = 0; x < grid.width; ++x) {
+            if (types[x] != EMPTY) {
+                setOccupied(bits, x);
+            }
+        }
+    }
+    grid.occupancyValid = true;
+}
+
+//one word, one cell at a time, exactly like the serial kernel
+static void stepWordScalar(uint64_t* row, uint64_t* below, int word, int y) {
+    uint64_t grains = row[word] & validMask(word);
+    while (grains) {
+        int x = word * 64 + lowestBit(grains);
+        grains &= grains - 1;
+
+        int toX;
+        if (!occupied(below, x)) {
+            toX = x;
+        }
+        else if (x > 0 && !occupied(below, x - 1)) {
+            toX = x - 1;
+        }
+        else if (x < grid.width - 1 && !occupied(below, x + 1)) {
+            toX = x + 1;
+        }
+        else {
+            continue;
+        }
+        setOccupied(below, toX);
+        row[word] &= ~(1ull << (x & 63));
+        movePlanes(x, y, toX, y - 1);
+    }
+}
+
+void updateBitboard() {
+    if (!grid.occupancyValid) {
+        rebuildOccupancy();
+    }
+
+    //cells that moved, handed to paintCells a chunk row at a time
+    DirtyRect moved = EMPTY_RECT;
+    for (int y = 1; y < grid.height; ++y) {
+        uint64_t* row = occupancyRow(y);
+        uint64_t* below = occupancyRow(y - 1);
+        int firstMoved = grid.occupancyWords;
+        int lastMoved = -1;
+
+        for (int word = 0; word < grid.occupancyWords; ++word) {
+            uint64_t valid = validMask(word);
+            uint64_t grains = row[word] & valid;
+            if (grains == 0) {
+                continue;
+            }
+
+            //walls and the padding past the last column count as full
+            uint64_t under = below[word] | ~valid;
+            uint64_t leftEdge = word > 0 ? below[word - 1] >> 63 : 1;
+            uint64_t rightEdge = word + 1 < grid.occupancyWords ? below[word + 1] & 1 : 1;
+            uint64_t downLeft = ((under | grains) << 1) | leftEdge;
+            uint64_t downRight = (under >> 1) | (rightEdge << 63);
+
+            uint64_t fall = grains & ~under;
+            uint64_t left = grains & under & ~downLeft;
+            uint64_t right = grains & under & downLeft & ~downRight;
+            if (right) {
+                stepWordScalar(row, below, word, y);
+                firstMoved = std::min(firstMoved, word);
+                lastMoved = word;
+                continue;
+            }
+            if ((fall | left) == 0) {
+                continue;
+            }
+            firstMoved = std::min(firstMoved, word);
+            lastMoved = word;
+
+            below[word] |= fall | (left >> 1);
+            if (left & 1) {
+                below[word - 1] |= 1ull << 63;
+            }
+            row[word] &= ~(fall | left);
+
+            for (uint64_t bits = fall; bits; bits &= bits - 1) {
+                int x = word * 64 + lowestBit(bits);
+                movePlanes(x, y, x, y - 1);
+            }
+            for (uint64_t bits = left; bits; bits &= bits - 1) {
+                int x = word * 64 + lowestBit(bits);
+                movePlanes(x, y, x - 1, y - 1);
+            }
+        }
+
+        //grains land up to one column either side of their word
+        if (lastMoved >= 0) {
+            expandRect(moved, std::max(firstMoved * 64 - 1, 0), y - 1, std::min(lastMoved * 64 + 64, grid.width - 1), y);
+        }
+        if ((y % CHUNK_SIZE == 0 || y == grid.height - 1) && moved.minX <= moved.maxX) {
+            paintCells(moved.minX, moved.minY, moved.maxX, moved.maxY);
+            moved = EMPTY_RECT;
+        }
+    }
+}
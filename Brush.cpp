@@ -0,0 +1,185 @@
+#include "Brush.h"
+#include "Replay.h"
+#include "Sim.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+static_assert((BRUSH_QUEUE_SIZE & (BRUSH_QUEUE_SIZE - 1)) == 0, "the ring size has to be a power of two");
+
+int brushRadius = 0;
+BrushShape brushShape = BRUSH_CIRCLE;
+float brushDensity = 1.0f;
+
+//head only moves on the producer, tail only on the consumer. they count up forever and are
+//masked into the ring, on their own cache lines so the two threads don't bounce one between them
+static BrushCommand ring[BRUSH_QUEUE_SIZE];
+alignas(64) static std::atomic<uint64_t> head(0);
+alignas(64) static std::atomic<uint64_t> tail(0);
+
+BrushCommand brushStroke(int fromX, int fromY, int toX, int toY, BrushTool tool) {
+    using namespace std::chrono;
+    BrushCommand command;
+    command.time = duration<double>(steady_clock::now().time_since_epoch()).count();
+    command.fromX = fromX / cellSize;
+    command.fromY = (grid.height - 1) - fromY / cellSize;
+    command.toX = toX / cellSize;
+    command.toY = (grid.height - 1) - toY / cellSize;
+    command.radius = brushRadius;
+    command.shape = brushShape;
+    command.density = brushDensity;
+    command.color = materialColor(currentMaterial, currentColor);
+    command.material = currentMaterial;
+    command.tool = tool;
+    return command;
+}
+
+bool pushBrushCommand(const BrushCommand& command) {
+    uint64_t at = head.load(std::memory_order_relaxed);
+    if (at - tail.load(std::memory_order_acquire) == BRUSH_QUEUE_SIZE) {
+        return false;
+    }
+    ring[at & (BRUSH_QUEUE_SIZE - 1)] = command;
+    head.store(at + 1, std::memory_order_release);
+    return true;
+}
+
+//keeps the part of the stroke within radius of the grid, further out a stamp paints nothing.
+//false if no part of it is. a scatter only lands from a cell inside the grid, its start is
+//never used. a stroke that is already inside comes back as it was
+static bool clipBrushCommand(BrushCommand& command) {
+    if (command.tool == BRUSH_SCATTER) {
+        command.fromX = command.toX;
+        command.fromY = command.toY;
+        return command.toX >= 0 && command.toX < grid.width && command.toY >= 0 && command.toY < grid.height;
+    }
+    command.radius = std::min(std::max(command.radius, 0), MAX_BRUSH_RADIUS);
+    double low = -command.radius;
+    double high[2] = { grid.width - 1.0 + command.radius, grid.height - 1.0 + command.radius };
+    double start[2] = { (double)command.fromX, (double)command.fromY };
+    double delta[2] = { (double)command.toX - command.fromX, (double)command.toY - command.fromY };
+    //liang-barsky, the part of the line from enter to leave is inside
+    double enter = 0.0, leave = 1.0;
+    for (int axis = 0; axis < 2; ++axis) {
+        if (delta[axis] == 0.0) {
+            if (start[axis] < low || start[axis] > high[axis]) {
+                return false;
+            }
+            continue;
+        }
+        double t0 = (low - start[axis]) / delta[axis], t1 = (high[axis] - start[axis]) / delta[axis];
+        enter = std::max(enter, std::min(t0, t1));
+        leave = std::min(leave, std::max(t0, t1));
+    }
+    if (enter > leave) {
+        return false;
+    }
+    if (leave < 1.0) {
+        command.toX = (int)std::lround(start[0] + leave * delta[0]);
+        command.toY = (int)std::lround(start[1] + leave * delta[1]);
+    }
+    if (enter > 0.0) {
+        command.fromX = (int)std::lround(start[0] + enter * delta[0]);
+        command.fromY = (int)std::lround(start[1] + enter * delta[1]);
+    }
+    return true;
+}
+
+int drainBrushCommands() {
+    uint64_t from = tail.load(std::memory_order_relaxed);
+    uint64_t to = head.load(std::memory_order_acquire);
+    for (uint64_t at = from; at != to; ++at) {
+        BrushCommand command = ring[at & (BRUSH_QUEUE_SIZE - 1)];
+        if (!clipBrushCommand(command)) {
+            continue;
+        }
+        recordBrushCommand(command);
+        applyBrushCommand(command);
+    }
+    tail.store(to, std::memory_order_release);
+    return (int)(to - from);
+}
+
+//the extent of every row the stroke touches, rows from firstRow up
+static std::vector<int> rowMin, rowMax;
+static int firstRow = 0;
+
+static void stamp(int x, int y, int radius, BrushShape shape) {
+    for (int dy = -radius; dy <= radius; ++dy) {
+        int halfWidth = shape == BRUSH_SQUARE ? radius : (int)std::sqrt((float)radius * radius - (float)dy * dy);
+        int row = y + dy - firstRow;
+        rowMin[row] = std::min(rowMin[row], x - halfWidth);
+        rowMax[row] = std::max(rowMax[row], x + halfWidth);
+    }
+}
+
+//a sparse brush writes runs of the cells that won the roll instead of the whole span
+static void fillSparseSpan(int x0, int x1, int y, CellType type, uint32_t color, float density) {
+    int runStart = -1;
+    for (int x = x0; x <= x1 + 1; ++x) {
+        bool hit = x <= x1 && grid.brushRandom.uniform() < density;
+        if (hit && runStart < 0) {
+            runStart = x;
+        }
+        else if (!hit && runStart >= 0) {
+            fillSpan(runStart, x - 1, y, type, color);
+            runStart = -1;
+        }
+    }
+}
+
+void applyBrushCommand(const BrushCommand& command) {
+    if (command.tool == BRUSH_SCATTER) {
+        scatterCell(command.toX, command.toY, command.material, command.color);
+        return;
+    }
+    //sized in 64 bits first. a stroke whose rows don't fit an int, or too long for the line's
+    //doubled error term to, isn't anything a grid could hold
+    int radius = std::max(command.radius, 0);
+    int64_t lowest = (int64_t)std::min(command.fromY, command.toY) - radius;
+    int64_t rowCount = std::abs((int64_t)command.toY - command.fromY) + 2 * (int64_t)radius + 1;
+    int64_t columns = std::abs((int64_t)command.toX - command.fromX);
+    if (lowest < INT_MIN || rowCount > INT_MAX / 4 || columns > INT_MAX / 4 || lowest + rowCount > INT_MAX) {
+        return;
+    }
+    firstRow = (int)lowest;
+    int rows = (int)rowCount;
+    rowMin.assign(rows, INT_MAX);
+    rowMax.assign(rows, INT_MIN);
+
+    int x = command.fromX, y = command.fromY;
+    int dx = std::abs(command.toX - x), dy = -std::abs(command.toY - y);
+    int stepX = x < command.toX ? 1 : -1, stepY = y < command.toY ? 1 : -1;
+    int error = dx + dy;
+    while (true) {
+        stamp(x, y, radius, command.shape);
+        if (x == command.toX && y == command.toY) {
+            break;
+        }
+        int error2 = 2 * error;
+        if (error2 >= dy) {
+            error += dy;
+            x += stepX;
+        }
+        if (error2 <= dx) {
+            error += dx;
+            y += stepY;
+        }
+    }
+
+    CellType type = command.tool == BRUSH_ERASE ? EMPTY : command.material;
+    for (int row = 0; row < rows; ++row) {
+        if (command.density >= 1.0f) {
+            fillSpan(rowMin[row], rowMax[row], firstRow + row, type, command.color);
+        }
+        else if (command.density > 0.0f) {
+            fillSparseSpan(std::max(rowMin[row], 0), std::min(rowMax[row], grid.width - 1),
+                firstRow + row, type, command.color, command.density);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Material.h"
+
+#include <cstdint>
+
+// paint fills the brush shape with the material, erase empties it, scatter drops a single cell a
+// little above the cursor like randomPlaceSand
+enum BrushTool {
+    BRUSH_PAINT,
+    BRUSH_ERASE,
+    BRUSH_SCATTER
+};
+
+enum BrushShape {
+    BRUSH_CIRCLE,
+    BRUSH_SQUARE,
+    BRUSH_SHAPE_COUNT
+};
+
+const char* const BRUSH_SHAPE_NAMES[BRUSH_SHAPE_COUNT] = { "circle", "square" };
+
+// the biggest radius the brush settings offer, and the biggest a session log may hold
+const int MAX_BRUSH_RADIUS = 64;
+
+// one brush event in grid cells, y = 0 at the bottom: the brush dragged from (fromX, fromY) to
+// (toX, toY), a click has both ends on the same cell. the color is already the cell's
+struct BrushCommand {
+    double time;        // steady clock seconds when the event came in
+    int fromX, fromY, toX, toY;
+    int radius;
+    BrushShape shape;
+    float density;      // share of the cells under the brush that get painted
+    uint32_t color;
+    CellType material;
+    BrushTool tool;
+};
+
+// brush settings the next commands are made with, from the input side
+extern int brushRadius;
+extern BrushShape brushShape;
+extern float brushDensity;
+
+// brush events go from the input callbacks to the simulation through a single producer, single
+// consumer ring: the thread handling input pushes, the thread ticking the simulation drains it at
+// the start of every tick. each side only writes its own index, so neither ever waits or locks.
+// a full ring drops new events until the next drain
+const int BRUSH_QUEUE_SIZE = 8192;
+
+// a command for a drag between two window positions (world pixels, y down) with the current
+// material, color and brush settings
+BrushCommand brushStroke(int fromX, int fromY, int toX, int toY, BrushTool tool);
+// false if the ring is full and the command was dropped
+bool pushBrushCommand(const BrushCommand& command);
+// applies everything pushed so far to the grid, returns how many commands that was. strokes are
+// cut down to the part that can reach the grid first (a drag can carry on outside the window),
+// and the ones that can't reach it are dropped
+int drainBrushCommands();
+
+// the shape is stamped on every cell of the line between the two ends (bresenham), so a fast
+// drag leaves no gaps. a line of convex stamps covers one run of cells per row, so the rows'
+// extents are gathered first and each row is written once with fillSpan, however big the brush
+void applyBrushCommand(const BrushCommand& command);
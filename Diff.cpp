@@ -0,0 +1,424 @@
+#include "Brush.h"
+#include "Scene.h"
+#include "Sim.h"
+#include "ThreadPool.h"
+
+#if defined(SAND_DIFF_GPU)
+#include "GpuContext.h"
+#include "GpuSim.h"
+#include <EGL/egl.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// differential test of the optimized engines against the ones that define what they should do:
+//   sand_diff [--pair name] [--ticks n] <scene file>
+//   sand_diff [--pair name] [--seed n] [--fuzz n]
+//
+// every pair runs the same world twice from scratch, once on the reference and once on the
+// candidate, hashing the grid after every tick. at the first tick the hashes differ both are run
+// again up to that tick and the first diverging cell is printed. the pairs are
+//   serial dirty chunks   serial stepping only the awake chunks, against a full scan
+//   bitboard, active      against serial with a full scan (both are the serial sweep)
+//   threaded              the worker pool against a single worker (the pass order is fixed, so the
+//                         number of threads must not matter)
+//   threaded one chunk    against serial with a full scan, on the world cut down to one chunk:
+//                         with a single chunk there is nothing for the passes to reorder
+//   gpu margolus          the compute shaders against the cpu margolus engine, when built with EGL
+// threaded and cpu margolus have nothing independent to match everywhere else, so they also run
+// on their own with every tick checked against what any engine's tick has to keep: cells only
+// move (each material keeps its count, and the counts setCell keeps agree with the type plane),
+// grains never rise and gas never sinks.
+// without a scene file it fuzzes: every seed builds a random world (size, filled boxes, sources
+// and brush strokes at random ticks, sparse and scattering ones too since their draws come from the
+// world's brush stream) and runs every pair and check on it. a failure prints the seed, and
+// --seed n --fuzz 1 runs that world again. exits with 1 if any pair diverged or check failed
+
+struct EngineSetup {
+    const char* name;
+    SimEngine engine;
+    bool dirtyChunks;
+    int workers;
+    bool gpu;
+};
+
+struct DiffPair {
+    const char* name;
+    EngineSetup reference;
+    EngineSetup candidate;
+    // margolus only knows the first four materials, and the two sides fall back differently
+    bool blockMaterialsOnly;
+    // run on the world cut down to its bottom left chunk, skipped for scene files
+    bool oneChunk;
+};
+
+static const EngineSetup SERIAL_FULL_SCAN = { "serial (full scan)", ENGINE_SERIAL, false, 1, false };
+
+static const EngineSetup THREADED_WORKERS = { "threaded (4 workers)", ENGINE_THREADED, true, 4, false };
+static const EngineSetup CPU_MARGOLUS = { "margolus", ENGINE_MARGOLUS, true, 1, false };
+
+static const DiffPair PAIRS[] = {
+    { "serial dirty chunks", SERIAL_FULL_SCAN, { "serial (dirty chunks)", ENGINE_SERIAL, true, 1, false }, false, false },
+    { "bitboard", SERIAL_FULL_SCAN, { "bitboard", ENGINE_BITBOARD, true, 1, false }, false, false },
+    { "active", SERIAL_FULL_SCAN, { "active", ENGINE_ACTIVE, true, 1, false }, false, false },
+    { "threaded", { "threaded (1 worker)", ENGINE_THREADED, true, 1, false }, THREADED_WORKERS, false, false },
+    { "threaded one chunk", SERIAL_FULL_SCAN, THREADED_WORKERS, false, true },
+#if defined(SAND_DIFF_GPU)
+    { "gpu margolus", CPU_MARGOLUS, { "gpu margolus", ENGINE_MARGOLUS, true, 1, true }, true, false },
+#endif
+};
+
+struct InvariantCheck {
+    const char* name;
+    EngineSetup setup;
+};
+
+static const InvariantCheck CHECKS[] = {
+    { "threaded invariants", THREADED_WORKERS },
+    { "margolus invariants", CPU_MARGOLUS },
+};
+
+struct DiffFill {
+    int x0, y0, x1, y1;
+    CellType material;
+    uint32_t color;
+};
+
+struct DiffStroke {
+    int tick;
+    BrushCommand command;
+};
+
+// everything needed to build the same world again
+struct DiffWorld {
+    const char* scenePath = nullptr;
+    int width = 0, height = 0;
+    std::vector<DiffFill> fills;
+    std::vector<SceneSource> sources;
+    std::vector<DiffStroke> strokes;
+    int ticks = 0;
+    bool blockMaterials = true;
+};
+
+static bool gpuReady = false;
+
+static bool buildWorld(const DiffWorld& world, Scene& scene) {
+    scene.sources.clear();
+    if (world.scenePath) {
+        resizeGrid(DEFAULT_GRID_WIDTH, DEFAULT_GRID_HEIGHT);
+        return loadScene(world.scenePath, scene);
+    }
+    resizeGrid(world.width, world.height);
+    for (const DiffFill& fill : world.fills) {
+        for (int y = fill.y0; y <= fill.y1; ++y) {
+            fillSpan(fill.x0, fill.x1, y, fill.material, fill.color);
+        }
+    }
+    scene.sources = world.sources;
+    return true;
+}
+
+//false with what went wrong in problem if the tick from before to the grid as it is now did
+//anything but move cells around, lifted a grain or sank gas. counted per row: with nothing
+//created or destroyed, a grain that rose would leave more grains at or above some row
+static bool tickHeld(const std::vector<uint8_t>& before, char* problem, size_t size) {
+    std::vector<size_t> rowsBefore((size_t)grid.height * MATERIAL_COUNT, 0), rowsAfter((size_t)grid.height * MATERIAL_COUNT, 0);
+    size_t counted[MATERIAL_COUNT] = {}, countedBefore[MATERIAL_COUNT] = {};
+    for (int y = 0; y < grid.height; ++y) {
+        for (int x = 0; x < grid.width; ++x) {
+            size_t i = cellIndex(x, y);
+            ++rowsBefore[(size_t)y * MATERIAL_COUNT + before[i]];
+            ++rowsAfter[(size_t)y * MATERIAL_COUNT + grid.type[i]];
+            ++countedBefore[before[i]];
+            ++counted[grid.type[i]];
+        }
+    }
+    for (int material = 0; material < MATERIAL_COUNT; ++material) {
+        if (counted[material] != countedBefore[material] || counted[material] != grid.materialCounts[material]) {
+            std::snprintf(problem, size, "%zu %s cells became %zu (materialCounts says %zu)", countedBefore[material],
+                MATERIALS[material].name, counted[material], grid.materialCounts[material]);
+            return false;
+        }
+        MaterialBehaviour behaviour = MATERIALS[material].behaviour;
+        if (behaviour != BEHAVIOUR_POWDER && behaviour != BEHAVIOUR_GAS) {
+            continue;
+        }
+        //grains at or above each row, from the top down. gas at or below each row, from the bottom up
+        bool rises = behaviour == BEHAVIOUR_GAS;
+        size_t was = 0, is = 0;
+        for (int row = 0; row < grid.height; ++row) {
+            int y = rises ? row : grid.height - 1 - row;
+            was += rowsBefore[(size_t)y * MATERIAL_COUNT + material];
+            is += rowsAfter[(size_t)y * MATERIAL_COUNT + material];
+            if (is > was) {
+                std::snprintf(problem, size, "%s %s past row %d", MATERIALS[material].name, rises ? "sank" : "rose", y);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//runs the world on one engine, hashing after every tick. stops after stopTick if it's given,
+//leaving that tick's grid behind. with problem given, every tick is checked with tickHeld and
+//the run stops at the first one that didn't hold
+static bool runWorld(const DiffWorld& world, const EngineSetup& setup, std::vector<uint64_t>& hashes, int stopTick = -1,
+    char* problem = nullptr, size_t problemSize = 0) {
+    simEngine = setup.engine;
+    useDirtyChunks = setup.dirtyChunks;
+    setWorkerCount(setup.workers);
+    recordCellWrites = setup.gpu;
+    Scene scene;
+    if (!buildWorld(world, scene)) {
+        return false;
+    }
+#if defined(SAND_DIFF_GPU)
+    if (setup.gpu && !uploadGpuWorld()) {
+        return false;
+    }
+#endif
+
+    hashes.clear();
+    std::vector<uint8_t> before;
+    for (int tick = 0; tick < world.ticks; ++tick) {
+        for (const DiffStroke& stroke : world.strokes) {
+            if (stroke.tick == tick) {
+                applyBrushCommand(stroke.command);
+            }
+        }
+        applySceneSources(scene);
+        if (problem) {
+            before.assign(grid.type, grid.type + (size_t)grid.width * grid.height);
+        }
+#if defined(SAND_DIFF_GPU)
+        if (setup.gpu) {
+            updateGpuSim();
+            downloadGpuWorld();
+        }
+        else {
+            updateSimulation();
+        }
+#else
+        updateSimulation();
+#endif
+        hashes.push_back(gridHash());
+        if (tick == stopTick) {
+            break;
+        }
+        if (problem) {
+            char what[200];
+            if (!tickHeld(before, what, sizeof(what))) {
+                std::snprintf(problem, problemSize, "after tick %d %s", tick, what);
+                break;
+            }
+        }
+    }
+    recordCellWrites = false;
+    return true;
+}
+
+static void describeWorld(const DiffWorld& world, uint32_t seed) {
+    if (world.scenePath) {
+        std::printf("%s, %d ticks", world.scenePath, world.ticks);
+    }
+    else {
+        std::printf("seed %u (%dx%d, %d ticks)", seed, world.width, world.height, world.ticks);
+    }
+}
+
+//false if the pair diverged, with the first tick and cell printed
+static bool runPair(const DiffPair& pair, const DiffWorld& world, uint32_t seed) {
+    std::vector<uint64_t> expected, got;
+    if (!runWorld(world, pair.reference, expected) || !runWorld(world, pair.candidate, got)) {
+        return false;
+    }
+    int tick = 0;
+    while (tick < world.ticks && expected[tick] == got[tick]) {
+        ++tick;
+    }
+    if (tick == world.ticks) {
+        return true;
+    }
+
+    //both again up to the tick that differed, keeping the reference's planes
+    size_t cells = (size_t)grid.width * grid.height;
+    runWorld(world, pair.reference, expected, tick);
+    std::vector<uint8_t> types(grid.type, grid.type + cells);
+    std::vector<uint32_t> colors(grid.color, grid.color + cells);
+    runWorld(world, pair.candidate, got, tick);
+
+    size_t first = cells, differing = 0;
+    for (size_t i = 0; i < cells; ++i) {
+        if (types[i] != grid.type[i] || colors[i] != grid.color[i]) {
+            first = std::min(first, i);
+            ++differing;
+        }
+    }
+    describeWorld(world, seed);
+    std::printf(": %s differs from %s after tick %d, %zu cells", pair.candidate.name, pair.reference.name, tick, differing);
+    if (first < cells) {
+        std::printf(", first at (%d, %d): %s %08x, expected %s %08x", (int)(first % grid.width), (int)(first / grid.width),
+            MATERIALS[grid.type[first]].name, grid.color[first], MATERIALS[types[first]].name, colors[first]);
+    }
+    std::printf("\n");
+    return false;
+}
+
+//false if a tick on the engine didn't hold, with the tick and what went wrong printed
+static bool runCheck(const InvariantCheck& check, const DiffWorld& world, uint32_t seed) {
+    std::vector<uint64_t> hashes;
+    char problem[256] = "";
+    if (!runWorld(world, check.setup, hashes, -1, problem, sizeof(problem))) {
+        return false;
+    }
+    if (problem[0] == '\0') {
+        return true;
+    }
+    describeWorld(world, seed);
+    std::printf(": %s, %s\n", check.setup.name, problem);
+    return false;
+}
+
+//the same world inside the bottom left chunk: boxes cut to fit, sources outside it dropped.
+//strokes clip themselves
+static DiffWorld oneChunkWorld(const DiffWorld& world) {
+    DiffWorld small = world;
+    small.width = std::min(world.width, CHUNK_SIZE);
+    small.height = std::min(world.height, CHUNK_SIZE);
+    small.fills.clear();
+    for (DiffFill fill : world.fills) {
+        if (fill.x0 < small.width && fill.y0 < small.height) {
+            fill.x1 = std::min(fill.x1, small.width - 1);
+            fill.y1 = std::min(fill.y1, small.height - 1);
+            small.fills.push_back(fill);
+        }
+    }
+    small.sources.clear();
+    for (const SceneSource& source : world.sources) {
+        if (source.x < small.width && source.y < small.height) {
+            small.sources.push_back(source);
+        }
+    }
+    return small;
+}
+
+//sizes that don't line up with chunks or 64-bit words, a few boxes of random materials (sand only
+//or the four block materials, sometimes anything), some sources and brush strokes along the way
+static DiffWorld randomWorld(uint32_t seed) {
+    RandomStream random = randomStream(STREAM_FUZZ, (uint64_t)seed << 32);
+    auto between = [&](int low, int high) { return low + random.below(high - low + 1); };
+
+    DiffWorld world;
+    world.width = between(3, 300);
+    world.height = between(3, 300);
+    world.ticks = between(20, 200);
+    int palette = between(0, 2);
+    int materials = palette == 0 ? SAND + 1 : palette == 1 ? 4 : MATERIAL_COUNT;
+    world.blockMaterials = materials <= 4;
+    auto material = [&]() { return (CellType)between(materials == SAND + 1 ? SAND : 0, materials - 1); };
+    auto color = [&]() { return random.next() | 0xff000000u; };
+
+    int fills = between(1, 12);
+    for (int i = 0; i < fills; ++i) {
+        int x0 = between(0, world.width - 1), y0 = between(0, world.height - 1);
+        world.fills.push_back({ x0, y0, between(x0, world.width - 1), between(y0, world.height - 1), material(), color() });
+    }
+    int sources = between(0, 6);
+    for (int i = 0; i < sources; ++i) {
+        world.sources.push_back({ between(0, world.width - 1), between(0, world.height - 1), material(), color() });
+    }
+    int strokes = between(0, 8);
+    for (int i = 0; i < strokes; ++i) {
+        BrushCommand command = {};
+        command.fromX = between(-4, world.width + 3);
+        command.fromY = between(-4, world.height + 3);
+        command.toX = between(-4, world.width + 3);
+        command.toY = between(-4, world.height + 3);
+        command.radius = between(0, 6);
+        command.shape = (BrushShape)between(0, BRUSH_SHAPE_COUNT - 1);
+        command.density = between(0, 1) == 0 ? 1.0f : between(1, 99) / 100.0f;
+        command.color = color();
+        command.material = material();
+        int tool = between(0, 5);
+        command.tool = tool == 0 ? BRUSH_ERASE : tool == 1 ? BRUSH_SCATTER : BRUSH_PAINT;
+        world.strokes.push_back({ between(0, world.ticks - 1), command });
+    }
+    return world;
+}
+
+int main(int argc, char** argv) {
+    const char* scenePath = nullptr;
+    const char* onlyPair = nullptr;
+    int ticks = 300;
+    uint32_t seed = 1;
+    int fuzz = 25;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--pair") == 0 && i + 1 < argc) {
+            onlyPair = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            ticks = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--fuzz") == 0 && i + 1 < argc) {
+            fuzz = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (argv[i][0] != '-' && !scenePath) {
+            scenePath = argv[i];
+        }
+        else {
+            std::fprintf(stderr, "usage: %s [--pair name] [--ticks n] <scene file>\n"
+                "       %s [--pair name] [--seed n] [--fuzz n]\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+#if defined(SAND_DIFF_GPU)
+    gpuReady = createSurfacelessGpuContext() && initializeGpuSim((GLADloadproc)eglGetProcAddress);
+    if (!gpuReady) {
+        std::printf("no gpu, skipping gpu margolus\n");
+    }
+#endif
+
+    int runs = 0, failures = 0;
+    for (int world = 0; world < (scenePath ? 1 : fuzz); ++world) {
+        DiffWorld diffWorld;
+        if (scenePath) {
+            diffWorld.scenePath = scenePath;
+            diffWorld.ticks = ticks;
+        }
+        else {
+            diffWorld = randomWorld(seed + world);
+        }
+        for (const DiffPair& pair : PAIRS) {
+            if ((onlyPair && std::strcmp(onlyPair, pair.name) != 0) || (pair.candidate.gpu && !gpuReady) ||
+                (pair.blockMaterialsOnly && !diffWorld.blockMaterials) || (pair.oneChunk && scenePath)) {
+                continue;
+            }
+            ++runs;
+            if (!runPair(pair, pair.oneChunk ? oneChunkWorld(diffWorld) : diffWorld, seed + world)) {
+                ++failures;
+            }
+        }
+        for (const InvariantCheck& check : CHECKS) {
+            if (onlyPair && std::strcmp(onlyPair, check.name) != 0) {
+                continue;
+            }
+            ++runs;
+            if (!runCheck(check, diffWorld, seed + world)) {
+                ++failures;
+            }
+        }
+    }
+    if (runs == 0) {
+        std::fprintf(stderr, "no pair by that name\n");
+        return 1;
+    }
+    std::printf("%d runs, %d failed\n", runs, failures);
+    return failures == 0 ? 0 : 1;
+}
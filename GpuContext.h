@@ -0,0 +1,6 @@
+#pragma once
+
+// a GL 4.3 core context with no surface, made current on the calling thread with glad loaded, for
+// the gpu backend in the tools that have no window. needs EGL, Mesa's llvmpipe is enough, so it
+// runs on machines without a gpu. prints why and returns false if there is none
+bool createSurfacelessGpuContext();
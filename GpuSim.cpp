@@ -0,0 +1,278 @@
+#include "GpuSim.h"
+#include "Sim.h"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_MAX_SHADER_STORAGE_BLOCK_SIZE 0x90DE
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#define GL_PIXEL_BUFFER_BARRIER_BIT 0x00000080
+#endif
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint x, GLuint y, GLuint z);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+static PFNGLDISPATCHCOMPUTEPROC dispatchCompute = nullptr;
+static PFNGLMEMORYBARRIERPROC memoryBarrier = nullptr;
+
+//one invocation per block, 8x8 blocks to a group. a block with anything the table doesn't cover
+//in it is left alone
+static const char* blockShaderSource = R"glsl(
+    #version 430 core
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(std430, binding = 0) buffer Types { uint types[]; };
+layout(std430, binding = 1) buffer Colors { uint colors[]; };
+layout(std430, binding = 2) readonly buffer Rules { uint rules[]; };
+
+uniform int gridWidth;
+uniform int gridHeight;
+uniform int offset;
+
+void main() {
+    int x = offset + int(gl_GlobalInvocationID.x) * 2;
+    int y = offset + int(gl_GlobalInvocationID.y) * 2;
+    if (x + 1 >= gridWidth || y + 1 >= gridHeight) {
+        return;
+    }
+
+    //top left, top right, bottom left, bottom right, like the cpu table
+    uint top = uint((y + 1) * gridWidth + x);
+    uint bottom = uint(y * gridWidth + x);
+    uint cells[4] = uint[4](top, top + 1u, bottom, bottom + 1u);
+    uint oldTypes[4];
+    uint state = 0u;
+    for (int i = 0; i < 4; ++i) {
+        oldTypes[i] = types[cells[i]];
+        if (oldTypes[i] > 3u) {
+            return;
+        }
+        state |= oldTypes[i] << (i * 2);
+    }
+
+    uint rule = rules[state];
+    if (rule == 0xE4u) {
+        return;
+    }
+    uint oldColors[4];
+    for (int i = 0; i < 4; ++i) {
+        oldColors[i] = colors[cells[i]];
+    }
+    for (int i = 0; i < 4; ++i) {
+        uint source = (rule >> (i * 2)) & 3u;
+        types[cells[i]] = oldTypes[source];
+        colors[cells[i]] = oldColors[source];
+    }
+}
+)glsl";
+
+//one invocation per brush write: cell index, type, color
+static const char* writeShaderSource = R"glsl(
+    #version 430 core
+layout(local_size_x = 64) in;
+
+layout(std430, binding = 0) buffer Types { uint types[]; };
+layout(std430, binding = 1) buffer Colors { uint colors[]; };
+layout(std430, binding = 3) readonly buffer Writes { uvec4 writes[]; };
+
+uniform uint writeCount;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= writeCount) {
+        return;
+    }
+    uvec4 write = writes[i];
+    types[write.x] = write.y;
+    colors[write.x] = write.z;
+}
+)glsl";
+
+static unsigned int blockProgram = 0, writeProgram = 0;
+static unsigned int widthLoc = 0, heightLoc = 0, offsetLoc = 0, writeCountLoc = 0;
+static unsigned int typeBuffer = 0, colorBuffer = 0, ruleBuffer = 0, writeBuffer = 0;
+static int gpuWidth = 0, gpuHeight = 0;
+static unsigned gpuTick = 0;
+
+static std::vector<size_t> pendingWrites;
+static std::vector<uint32_t> writeData;
+
+static unsigned int compileProgram(const char* source) {
+    unsigned int shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    int compiled = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        std::cerr << "compute shader didn't compile: " << log << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    glDeleteShader(shader);
+    int linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+bool initializeGpuSim(GLADloadproc loadProc) {
+    int major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major < 4 || (major == 4 && minor < 3)) {
+        std::cerr << "the gpu backend needs GL 4.3, the context is " << major << "." << minor << std::endl;
+        return false;
+    }
+    dispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)loadProc("glDispatchCompute");
+    memoryBarrier = (PFNGLMEMORYBARRIERPROC)loadProc("glMemoryBarrier");
+    blockProgram = compileProgram(blockShaderSource);
+    writeProgram = compileProgram(writeShaderSource);
+    if (!dispatchCompute || !memoryBarrier || !blockProgram || !writeProgram) {
+        return false;
+    }
+    widthLoc = glGetUniformLocation(blockProgram, "gridWidth");
+    heightLoc = glGetUniformLocation(blockProgram, "gridHeight");
+    offsetLoc = glGetUniformLocation(blockProgram, "offset");
+    writeCountLoc = glGetUniformLocation(writeProgram, "writeCount");
+
+    glGenBuffers(1, &typeBuffer);
+    glGenBuffers(1, &colorBuffer);
+    glGenBuffers(1, &ruleBuffer);
+    glGenBuffers(1, &writeBuffer);
+
+    uint32_t rules[256];
+    const uint8_t* table = margolusRules();
+    for (int state = 0; state < 256; ++state) {
+        rules[state] = table[state];
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ruleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(rules), rules, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    recordCellWrites = true;
+    return true;
+}
+
+bool uploadGpuWorld() {
+    size_t cells = (size_t)grid.width * grid.height;
+    GLint64 maxBlock = 0;
+    glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlock);
+    if (cells * sizeof(uint32_t) > (size_t)maxBlock) {
+        std::cerr << "world is bigger than a storage buffer (" << maxBlock << " bytes)" << std::endl;
+        return false;
+    }
+
+    //types are widened to a uint each, neighbouring blocks would share a word otherwise
+    std::vector<uint32_t> types(grid.type, grid.type + cells);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, typeBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cells * sizeof(uint32_t), types.data(), GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, colorBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cells * sizeof(uint32_t), grid.color, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    gpuWidth = grid.width;
+    gpuHeight = grid.height;
+    gpuTick = 0;
+    //the grid already holds everything written so far
+    takeCellWrites(pendingWrites);
+    return true;
+}
+
+void applyGpuCellWrites() {
+    takeCellWrites(pendingWrites);
+    if (pendingWrites.empty() || gpuWidth != grid.width || gpuHeight != grid.height) {
+        return;
+    }
+
+    //a cell written twice is sent twice with the same (final) value, so the order doesn't matter
+    writeData.clear();
+    for (size_t index : pendingWrites) {
+        writeData.insert(writeData.end(), { (uint32_t)index, grid.type[index], grid.color[index], 0u });
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, writeBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, writeData.size() * sizeof(uint32_t), writeData.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glUseProgram(writeProgram);
+    glUniform1ui(writeCountLoc, (GLuint)pendingWrites.size());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, typeBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, colorBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, writeBuffer);
+    dispatchCompute((GLuint)((pendingWrites.size() + 63) / 64), 1, 1);
+    memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glUseProgram(0);
+}
+
+void updateGpuSim() {
+    applyGpuCellWrites();
+    if (isPaused || gpuWidth != grid.width || gpuHeight != grid.height) {
+        return;
+    }
+
+    int offset = gpuTick++ & 1;
+    GLuint blocksX = (GLuint)((gpuWidth - offset) / 2);
+    GLuint blocksY = (GLuint)((gpuHeight - offset) / 2);
+    glUseProgram(blockProgram);
+    glUniform1i(widthLoc, gpuWidth);
+    glUniform1i(heightLoc, gpuHeight);
+    glUniform1i(offsetLoc, offset);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, typeBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, colorBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ruleBuffer);
+    dispatchCompute((blocksX + 7) / 8, (blocksY + 7) / 8, 1);
+    //the next tick reads the cells, the renderer copies the colors out of the buffer
+    memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    glUseProgram(0);
+}
+
+void downloadGpuWorld() {
+    if (gpuWidth != grid.width || gpuHeight != grid.height) {
+        return;
+    }
+    size_t cells = (size_t)grid.width * grid.height;
+    std::vector<uint32_t> types(cells);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, typeBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, cells * sizeof(uint32_t), types.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, colorBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, cells * sizeof(uint32_t), grid.color);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    std::fill(grid.materialCounts, grid.materialCounts + MATERIAL_COUNT, 0);
+    for (size_t i = 0; i < cells; ++i) {
+        grid.type[i] = (uint8_t)types[i];
+        ++grid.materialCounts[grid.type[i]];
+    }
+    //every engine's bookkeeping is out of date
+    grid.occupancyValid = false;
+    grid.activeValid = false;
+    wakeAll();
+    paintCells(0, 0, grid.width - 1, grid.height - 1);
+}
+
+unsigned int gpuColorBuffer() {
+    return colorBuffer;
+}
+
+void shutdownGpuSim() {
+    recordCellWrites = false;
+    glDeleteProgram(blockProgram);
+    glDeleteProgram(writeProgram);
+    unsigned int buffers[] = { typeBuffer, colorBuffer, ruleBuffer, writeBuffer };
+    glDeleteBuffers(4, buffers);
+}
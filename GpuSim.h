@@ -0,0 +1,28 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// the gpu backend runs the margolus rules (the same block table as the cpu engine) as GL 4.3
+// compute shaders. the world lives in two shader storage buffers, a uint type and a packed rgba8
+// color per cell, and each tick is one dispatch over the blocks of that tick's offset. blocks
+// never share cells, so the invocations can't race.
+//
+// the cpu grid is only the source for uploadGpuWorld and for cells the brush writes: setCell
+// records what it wrote, and those cells are copied up in one small batch before the next tick.
+// blocks holding a material past the first four (gas) stay put.
+// needs a current 4.3 context with glad loaded
+
+// false if the context can't run compute shaders
+bool initializeGpuSim(GLADloadproc loadProc);
+// copies the whole cpu grid up, after a resize or a reset. false if the world is bigger than a
+// storage buffer can hold
+bool uploadGpuWorld();
+// copies the brush writes recorded since the last call up
+void applyGpuCellWrites();
+// applies the brush writes, then steps one tick (nothing while paused)
+void updateGpuSim();
+// copies the world back into the cpu grid
+void downloadGpuWorld();
+// the color buffer, laid out like grid.color, for the renderer to copy from
+unsigned int gpuColorBuffer();
+void shutdownGpuSim();
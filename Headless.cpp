@@ -0,0 +1,259 @@
+#include "Sim.h"
+#include "Replay.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+#include "WorldFile.h"
+
+#if defined(SAND_HEADLESS_GPU)
+#include "GpuContext.h"
+#include "GpuSim.h"
+#include <EGL/egl.h>
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// runs the simulation without a window:
+//   sand_headless [--full-scan] [--engine name] [--threads n] [--size WxH] [--seed n] [--gpu] <scene file> [ticks]
+//   sand_headless [--full-scan] [--engine name] [--threads n] [--gpu] --load <world file> [ticks]
+//   sand_headless [--engine name] [--threads n] [--gpu] --replay <session log>
+// any of them takes --save <world file> to write the world out at the end
+//
+// --size sets the world size before the scene loads (a "size" line in the scene still wins)
+// --full-scan steps every chunk every tick instead of only the awake ones
+// --seed sets the random seed (0 by default), the same seed and scene give the same world
+// --engine picks one of ENGINE_NAMES, --threads sizes the worker pool for the threaded engine
+// --load starts from a world saved with --save or from the app (WorldFile.h), where it left off
+// --replay runs a session recorded with falling_sand --record (Replay.h) as fast as it can: the
+// recording's seed, world and engine, every stroke at the tick it landed, then checks the grid
+// against the hash taken when the recording stopped and exits with 1 if it differs. --engine
+// pins one engine for the whole run instead of following the session's
+// --gpu runs the compute shader backend on a surfaceless EGL context instead (only in builds
+// that found EGL). Mesa's llvmpipe is enough, so it runs on machines without a gpu
+
+static bool parseEngine(const char* name, SimEngine& engine) {
+    for (int i = 0; i < ENGINE_COUNT; ++i) {
+        if (std::strcmp(name, ENGINE_NAMES[i]) == 0) {
+            engine = (SimEngine)i;
+            return true;
+        }
+    }
+    std::fprintf(stderr, "unknown engine '%s'\n", name);
+    return false;
+}
+
+int main(int argc, char** argv) {
+    const char* scenePath = nullptr;
+    const char* replayPath = nullptr;
+    const char* loadPath = nullptr;
+    const char* savePath = nullptr;
+    std::vector<const char*> positional;
+    int ticks = 1000;
+    bool gpu = false;
+    bool pinnedEngine = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--full-scan") == 0) {
+            useDirtyChunks = false;
+        }
+        else if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            if (!parseEngine(argv[++i], simEngine)) {
+                return 1;
+            }
+            pinnedEngine = true;
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            setWorkerCount(std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            int width, height;
+            if (std::sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                std::fprintf(stderr, "bad size '%s', expected WxH\n", argv[i]);
+                return 1;
+            }
+            resizeGrid(width, height);
+        }
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            loadPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            savePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            setRandomSeed(std::strtoull(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--gpu") == 0) {
+#if defined(SAND_HEADLESS_GPU)
+            gpu = true;
+#else
+            std::fprintf(stderr, "this build has no gpu backend\n");
+            return 1;
+#endif
+        }
+        else {
+            positional.push_back(argv[i]);
+        }
+    }
+    //a scene file and then the ticks, only the ticks when the world comes from elsewhere
+    size_t next = 0;
+    if (!loadPath && !replayPath && next < positional.size()) {
+        scenePath = positional[next++];
+    }
+    if (next < positional.size() && !replayPath) {
+        ticks = std::atoi(positional[next++]);
+    }
+    if (next != positional.size() || (scenePath != nullptr) + (loadPath != nullptr) + (replayPath != nullptr) != 1) {
+        std::fprintf(stderr, "usage: %s [--full-scan] [--engine name] [--threads n] [--size WxH] [--seed n] [--gpu] <scene file> [ticks]\n"
+            "       %s [--full-scan] [--engine name] [--threads n] [--gpu] --load <world file> [ticks]\n"
+            "       %s [--engine name] [--threads n] [--gpu] --replay <session log>\n"
+            "       any of them with --save <world file>\n", argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    Scene scene;
+    ReplayLog log;
+    ReplayCursor cursor;
+    if (replayPath) {
+        if (!loadReplay(replayPath, log)) {
+            return 1;
+        }
+        SimEngine pinned = simEngine;
+        cursor = beginReplay(log);
+        if (pinnedEngine) {
+            simEngine = pinned;
+        }
+        if (log.gpu && !gpu) {
+            std::printf("recorded on the gpu, replaying on cpu margolus (the same for the first four materials)\n");
+        }
+    }
+    else if (loadPath) {
+        auto loadStart = std::chrono::steady_clock::now();
+        if (!loadWorld(loadPath)) {
+            return 1;
+        }
+        std::printf("loaded %s in %.2f ms\n", loadPath,
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count());
+    }
+    else if (!loadScene(scenePath, scene)) {
+        return 1;
+    }
+#if defined(SAND_HEADLESS_GPU)
+    if (gpu && !(createSurfacelessGpuContext() && initializeGpuSim((GLADloadproc)eglGetProcAddress) && uploadGpuWorld())) {
+        return 1;
+    }
+#endif
+
+    using namespace std::chrono;
+    long long awakeChunks = 0;
+    long long activeCells = 0;
+    int fallbackTicks = 0;
+    auto step = [&]() {
+#if defined(SAND_HEADLESS_GPU)
+        if (gpu) {
+            updateGpuSim();
+            return;
+        }
+#endif
+        updateSimulation();
+        fallbackTicks += steppedEngine != simEngine;
+        awakeChunks += countAwakeChunks();
+        activeCells += countActiveCells();
+    };
+
+    ReplayEvent event = {};
+    bool replayEnded = false;
+    long long replayedEvents = 0;
+    auto start = high_resolution_clock::now();
+    if (replayPath) {
+        ticks = 0;
+        while (nextReplayEvent(log, cursor, event)) {
+            for (uint64_t i = 0; i < event.ticksBefore; ++i) {
+                step();
+            }
+            ticks += (int)event.ticksBefore;
+            if (event.kind == REPLAY_END) {
+                replayEnded = true;
+                break;
+            }
+            ++replayedEvents;
+            if (event.kind == REPLAY_ENGINE && pinnedEngine) {
+                continue;
+            }
+            applyReplayEvent(event);
+#if defined(SAND_HEADLESS_GPU)
+            if (gpu && (event.kind == REPLAY_RESET || event.kind == REPLAY_RESIZE) && !uploadGpuWorld()) {
+                return 1;
+            }
+#endif
+        }
+    }
+    else {
+        for (int tick = 0; tick < ticks; ++tick) {
+            applySceneSources(scene);
+            step();
+        }
+    }
+#if defined(SAND_HEADLESS_GPU)
+    if (gpu) {
+        //the dispatches only count once they're done
+        glFinish();
+    }
+#endif
+    double elapsed = duration<double>(high_resolution_clock::now() - start).count();
+#if defined(SAND_HEADLESS_GPU)
+    if (gpu) {
+        downloadGpuWorld();
+    }
+#endif
+
+    double cells = (double)grid.width * grid.height * ticks;
+    if (gpu) {
+        std::printf("engine: gpu margolus\n");
+    }
+    else {
+        std::printf("engine: %s (%d threads)\n", ENGINE_NAMES[simEngine], simEngine == ENGINE_THREADED ? workerCount() : 1);
+        if (fallbackTicks > 0) {
+            //what was asked for isn't what ran, the numbers below are mostly serial's
+            std::printf("ran serial for %d of %d ticks, where the world was more than %s takes\n", fallbackTicks, ticks,
+                ENGINE_NAMES[simEngine]);
+        }
+    }
+    std::printf("grid: %dx%d\n", grid.width, grid.height);
+    std::printf("ticks: %d\n", ticks);
+    std::printf("elapsed: %.6f s\n", elapsed);
+    std::printf("ticks/s: %.1f\n", elapsed > 0.0 ? ticks / elapsed : 0.0);
+    std::printf("cell updates/s: %.3e\n", elapsed > 0.0 ? cells / elapsed : 0.0);
+    if (!gpu && simEngine == ENGINE_ACTIVE) {
+        std::printf("active particles/tick: %.1f\n", ticks > 0 ? (double)activeCells / ticks : 0.0);
+    }
+    else if (!gpu) {
+        std::printf("awake chunks/tick: %.1f of %d\n", ticks > 0 ? (double)awakeChunks / ticks : 0.0, grid.chunksX * grid.chunksY);
+    }
+    std::printf("particles: %d\n", countParticles());
+    std::printf("hash: %016llx\n", (unsigned long long)gridHash());
+    if (savePath) {
+        auto saveStart = steady_clock::now();
+        if (!saveWorld(savePath)) {
+            return 1;
+        }
+        std::printf("saved %s in %.2f ms\n", savePath, duration<double, std::milli>(steady_clock::now() - saveStart).count());
+    }
+    if (replayPath) {
+        std::printf("events: %lld\n", replayedEvents);
+        if (!replayEnded) {
+            std::printf("the session log stops early, nothing to check the grid against\n");
+            return 1;
+        }
+        if (event.hasHash) {
+            bool same = event.hash == gridHash();
+            std::printf("recorded hash: %016llx (%s)\n", (unsigned long long)event.hash, same ? "matches" : "differs");
+            return same ? 0 : 1;
+        }
+    }
+    return 0;
+}
@@ -9,21 +9,26 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "Brush.h"
+#include "GpuSim.h"
+#include "Profiler.h"
+#include "Render.h"
+#include "Replay.h"
+#include "Sim.h"
+#include "SimThread.h"
+#include "WorldFile.h"
+
+#include <algorithm>
 #include <iostream>
 #include <random>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
 
 
-const int h = 800;
-const int w = 800;
-
-const int CELL_SIZE = 5;
-const int GRID_WIDTH = w / CELL_SIZE;
-const int GRID_HEIGHT = h / CELL_SIZE;
-
-float sand = CELL_SIZE;
-
-bool isPaused = false;
 bool leftmousePressed = false;
 bool rightmousePressed = false;
 
@@ -33,232 +38,14 @@ float speed = 7.0f;
 
 float r, g, b;
 
+//last cursor sample in world pixels, strokes are drawn from it to the next one
 double mouseX, mouseY;
-
-enum CellType {
-    EMPTY,
-    SAND
-};
-
-struct Cell {
-    CellType type;
-    glm::vec4 color;
-
-};
-
-Cell grid[GRID_HEIGHT][GRID_WIDTH];
-glm::vec4 currentColor = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+//the left button erases instead of painting
+bool erasing = false;
 
 std::chrono::high_resolution_clock::time_point lastColorUpdateTime;
 
 
-const char* vertexShaderSource = R"glsl(
-    #version 330 core
-layout(location = 0) in vec2 aPos; 
-layout(location = 1) in vec2 instancePosition; 
-layout(location = 2) in vec4 instanceColor;    
-
-uniform mat4 projection;
-
-out vec4 vColor; 
-
-void main() {
-    
-    gl_Position = projection * vec4(aPos + instancePosition, 0.0, 1.0);
-    vColor = instanceColor;
-}
-)glsl";
-
-const char* fragmentShaderSource = R"glsl(
-    #version 330 core
-out vec4 FragColor;
-
-in vec4 vColor; 
-
-void main() {
-    FragColor = vColor;
-}
-)glsl";
-
-unsigned int compileShader(unsigned int type, const char* source) {
-    unsigned int shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, nullptr);
-    glCompileShader(shader);
-    return shader;
-}
-
-unsigned int createShaderProgram() {
-    unsigned int vertexShader = compileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    unsigned int fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
-    unsigned int shaderProgram = glCreateProgram();
-
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    return shaderProgram;
-}
-
-void initializeGrid() {
-    for (int y = 0; y < GRID_HEIGHT; ++y) {
-        for (int x = 0; x < GRID_WIDTH; ++x) {
-            grid[y][x] = { EMPTY, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f) };
-        }
-    }
-}
-
-//add ( && grid[gridY - 1][gridX].type == EMPTY to all if statements to stop drawing on pre-existing sand)
-
-void placeSand(int mouseX, int mouseY) {
-    int gridX = mouseX / CELL_SIZE;
-    int gridY = (GRID_HEIGHT - 1) - mouseY / CELL_SIZE;
-
-    if (gridX < 0 || gridX > GRID_WIDTH || gridY < 0 || gridY > GRID_HEIGHT) {
-        return;
-    }
-    if (gridX + 1 < GRID_WIDTH && gridY - 1 >= 0) {
-        grid[gridY - 1][gridX] = { SAND, currentColor };
-    }
-}
-
-void randomPlaceSand(int mouseX, int mouseY) {
-    int gridX = mouseX / CELL_SIZE;
-    int gridY = (GRID_HEIGHT - 1) - mouseY / CELL_SIZE;
-
-    if (gridX < 0 || gridX >= GRID_WIDTH || gridY < 0 || gridY >= GRID_HEIGHT) {
-        return;
-    }
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 2);
-    int direction = dis(gen);
-
-    if (direction == 0) {
-        if (gridY + 2 < GRID_HEIGHT) {
-            grid[gridY + 2][gridX] = { SAND, currentColor };
-        }
-    }
-    else if (direction == 1) {
-        if (gridX - 1 >= 0 && gridY + 1 < GRID_HEIGHT) {
-            grid[gridY + 1][gridX - 1] = { SAND, currentColor };
-        }
-    }
-    else if (direction == 2) {
-        if (gridX + 1 < GRID_WIDTH && gridY + 1 < GRID_HEIGHT) {
-            grid[gridY + 1][gridX + 1] = { SAND, currentColor };
-        }
-    }
-}
-
-void updateSimulation() {
-    if (!isPaused) {
-        for (int y = 0; y < GRID_HEIGHT; ++y) {
-            for (int x = 0; x < GRID_WIDTH; ++x) {
-                if (grid[y][x].type == SAND) {
-                    if (y - 1 >= 0 && grid[y - 1][x].type == EMPTY) {
-                        grid[y - 1][x] = { SAND, grid[y][x].color };
-                        grid[y][x] = { EMPTY, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f) };
-                    }
-                    else if (x > 0 && y - 1 >= 0 && grid[y - 1][x - 1].type == EMPTY) {
-                        grid[y - 1][x - 1] = { SAND, grid[y][x].color };
-                        grid[y][x] = { EMPTY, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f) };
-                    }
-                    else if (x < GRID_WIDTH - 1 && y - 1 >= 0 && grid[y - 1][x + 1].type == EMPTY) {
-                        grid[y - 1][x + 1] = { SAND, grid[y][x].color };
-                        grid[y][x] = { EMPTY, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f) };
-                    }
-                }
-            }
-        }
-    }
-}
-
-unsigned int VAO = 0, VBO = 0, instanceVBO=0;
-
-struct InstanceData {
-    glm::vec2 position;
-    glm::vec4 color;
-};
-
-void initializeRenderingResources() {
-    
-    float vertices[] = {
-        0.0f,      0.0f,
-        CELL_SIZE, 0.0f,
-        CELL_SIZE, CELL_SIZE,
-        0.0f,      CELL_SIZE
-    };
-
-    unsigned int indices[] = {
-        0, 1, 2, 3
-    };
-
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    
-
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-
-    //instancevbo data
-    glGenBuffers(1, &instanceVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-
-    //pos
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, position));
-    glVertexAttribDivisor(1, 1); 
-
-    //col
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, color));
-    glVertexAttribDivisor(2, 1); 
-
-    glBindVertexArray(0);
-}
-
-void renderGrid(unsigned int shaderProgram, unsigned int projectionLoc) { 
-    glUseProgram(shaderProgram);
-
-    glm::mat4 projection = glm::ortho(0.0f, (float)w, 0.0f, (float)h);
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    std::vector<InstanceData> instances;
-    instances.reserve(GRID_WIDTH * GRID_HEIGHT / 4);
-
-    for (int y = 0; y < GRID_HEIGHT; ++y) {
-        for (int x = 0; x < GRID_WIDTH; ++x) {
-            if (grid[y][x].type == SAND) {
-                
-                instances.push_back({ glm::vec2(x * CELL_SIZE, y * CELL_SIZE), grid[y][x].color });
-            }
-        }
-    }
-
-    if (instances.empty()) {
-        return; 
-    }
-
-    //giving the gpu instance data
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), instances.data(), GL_STREAM_DRAW);
-
-    
-    glBindVertexArray(VAO);
-    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, instances.size());
-    glBindVertexArray(0);
-
-    glUseProgram(0);
-}
-
 glm::vec4 rgbToHsv(const glm::vec4& color) {
     r = color.r;
     g = color.g;
@@ -336,24 +123,35 @@ void updateColor() {
     }
 }
 
+//the window can be dragged to any size, brushAt wants positions in world pixels (grid * cellSize)
+void windowToWorld(GLFWwindow* window, double& x, double& y) {
+    int windowWidth, windowHeight;
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+    if (windowWidth > 0 && windowHeight > 0) {
+        x *= (double)grid.width * cellSize / windowWidth;
+        y *= (double)grid.height * cellSize / windowHeight;
+    }
+}
+
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
     glfwGetCursorPos(window, &mouseX, &mouseY);
+    windowToWorld(window, mouseX, mouseY);
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
-    currentColor = glm::vec4(dis(gen), dis(gen), dis(gen), 1.0f);
+    RandomStream& random = threadRandom();
+    currentColor = glm::vec4(random.uniform(), random.uniform(), random.uniform(), 1.0f);
 
     if (action == GLFW_PRESS) {
         if (button == GLFW_MOUSE_BUTTON_LEFT) {
             leftmousePressed = true;
-            placeSand(static_cast<int>(mouseX), static_cast<int>(mouseY));
+            int x = static_cast<int>(mouseX), y = static_cast<int>(mouseY);
+            pushBrushCommand(brushStroke(x, y, x, y, erasing ? BRUSH_ERASE : BRUSH_PAINT));
             updateColor();
         }
 
         else if (button == GLFW_MOUSE_BUTTON_RIGHT) {
             rightmousePressed = true;
-            randomPlaceSand(static_cast<int>(mouseX), static_cast<int>(mouseY));
+            int x = static_cast<int>(mouseX), y = static_cast<int>(mouseY);
+            pushBrushCommand(brushStroke(x, y, x, y, BRUSH_SCATTER));
             updateColor();
         }
     }
@@ -370,17 +168,79 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
 }
 
 void cursorPositionCallback(GLFWwindow* window, double xpos, double ypos) {
+    windowToWorld(window, xpos, ypos);
+    int fromX = static_cast<int>(mouseX), fromY = static_cast<int>(mouseY);
+    int toX = static_cast<int>(xpos), toY = static_cast<int>(ypos);
     if (leftmousePressed) {
-        placeSand(static_cast<int>(xpos), static_cast<int>(ypos));
+        pushBrushCommand(brushStroke(fromX, fromY, toX, toY, erasing ? BRUSH_ERASE : BRUSH_PAINT));
     }
     else if (rightmousePressed) {
-        randomPlaceSand(static_cast<int>(xpos), static_cast<int>(ypos));
+        pushBrushCommand(brushStroke(fromX, fromY, toX, toY, BRUSH_SCATTER));
     }
+    mouseX = xpos;
+    mouseY = ypos;
+}
+
+//the gpu couldn't take the world, the cpu engines carry on with it
+void leaveGpu() {
+    std::cerr << "switching to the cpu engines" << std::endl;
+    gridOnGpu = false;
+    recordCellWrites = false;
+    recordEngine(simEngine, useDirtyChunks);
+    startSimThread();
+}
+
+//the world file the save and load buttons and F5 / F9 use
+char worldPath[256] = "world.sand";
+
+void saveWorldFile() {
+    std::lock_guard<std::mutex> lock(gridMutex);
+    if (gridOnGpu) {
+        downloadGpuWorld();
+    }
+    if (saveWorld(worldPath)) {
+        std::cout << "saved " << worldPath << std::endl;
+    }
+}
+
+//the window follows the loaded world's size, like applyWorldSize
+void loadWorldFile(GLFWwindow* window) {
+    {
+        std::lock_guard<std::mutex> lock(gridMutex);
+        //a replay has no way to get at the file, so the session log ends here
+        if (isRecording()) {
+            if (gridOnGpu) {
+                downloadGpuWorld();
+            }
+            stopRecording();
+            std::cout << "loading a world ends the recording" << std::endl;
+        }
+        if (!loadWorld(worldPath)) {
+            return;
+        }
+    }
+    if (gridOnGpu && !uploadGpuWorld()) {
+        leaveGpu();
+    }
+    glfwSetWindowSize(window, grid.width * cellSize, grid.height * cellSize);
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS) {
+        saveWorldFile();
+        return;
+    }
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS) {
+        loadWorldFile(window);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(gridMutex);
     if (key == GLFW_KEY_R && action == GLFW_PRESS) {
         initializeGrid();
+        recordReset();
+        if (gridOnGpu) {
+            uploadGpuWorld();
+        }
     }
 
     else if (key == GLFW_KEY_P && action == GLFW_RELEASE) { 
@@ -388,14 +248,138 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     }
 }
 
-int main() {
+//rebuilds the world at a new size, the window follows so cells stay square
+void applyWorldSize(GLFWwindow* window, int width, int height, int newCellSize) {
+    cellSize = newCellSize;
+    {
+        std::lock_guard<std::mutex> lock(gridMutex);
+        resizeGrid(width, height);
+        recordResize(width, height);
+    }
+    if (gridOnGpu && !uploadGpuWorld()) {
+        leaveGpu();
+    }
+    glfwSetWindowSize(window, width * cellSize, height * cellSize);
+}
+
+//a bar per frame of the stages timed once a frame stacked up, newest on the right, and the
+//percentiles of every stage over its history
+void profilerWindow() {
+    static float samples[STAGE_COUNT][PROFILE_HISTORY];
+    int counts[STAGE_COUNT];
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        counts[stage] = stageHistory((ProfileStage)stage, samples[stage]);
+    }
+
+    ImGui::Begin("Profiler");
+    const float plotHeight = 120.0f;
+    float plotWidth = ImGui::GetContentRegionAvail().x;
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    int frames = counts[STAGE_INPUT];
+    //the scale fits the slowest frame but never goes under 60 fps
+    float scale = 1000.0f / 60.0f;
+    for (int i = 0; i < frames; ++i) {
+        float total = 0.0f;
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+            if (stageIsPerFrame((ProfileStage)stage)) {
+                total += samples[stage][i];
+            }
+        }
+        scale = std::max(scale, total);
+    }
+
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    drawList->AddRectFilled(origin, ImVec2(origin.x + plotWidth, origin.y + plotHeight), IM_COL32(20, 20, 20, 255));
+    float barWidth = plotWidth / PROFILE_HISTORY;
+    for (int i = 0; i < frames; ++i) {
+        float left = origin.x + (PROFILE_HISTORY - frames + i) * barWidth;
+        float bottom = origin.y + plotHeight;
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+            if (!stageIsPerFrame((ProfileStage)stage)) {
+                continue;
+            }
+            float top = bottom - samples[stage][i] / scale * plotHeight;
+            drawList->AddRectFilled(ImVec2(left, top), ImVec2(left + barWidth, bottom), ImColor::HSV(stage / (float)STAGE_COUNT, 0.7f, 0.9f));
+            bottom = top;
+        }
+    }
+    ImGui::Dummy(ImVec2(plotWidth, plotHeight));
+    ImGui::Text("top of the plot is %.1f ms", scale);
+
+    if (ImGui::BeginTable("stages", 4, ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("stage (ms)");
+        ImGui::TableSetupColumn("p50");
+        ImGui::TableSetupColumn("p95");
+        ImGui::TableSetupColumn("p99");
+        ImGui::TableHeadersRow();
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            if (stageIsPerFrame((ProfileStage)stage)) {
+                ImGui::TextColored(ImColor::HSV(stage / (float)STAGE_COUNT, 0.7f, 0.9f), "%s", STAGE_NAMES[stage]);
+            }
+            else {
+                ImGui::TextUnformatted(STAGE_NAMES[stage]);
+            }
+            if (counts[stage] == 0) {
+                continue;
+            }
+            for (float percentile : { 50.0f, 95.0f, 99.0f }) {
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", stagePercentile((ProfileStage)stage, percentile));
+            }
+        }
+        ImGui::EndTable();
+    }
+    ImGui::End();
+}
+
+//  falling_sand [--size WxH] [--cell n] [--seed n] [--record file] [--gpu]
+//  --seed fixes the random seed, otherwise a fresh one is picked and printed
+//  --record logs the session for sand_headless --replay (Replay.h)
+//  --gpu runs the simulation as compute shaders (GpuSim.h), which needs GL 4.3
+int main(int argc, char** argv) {
+    int worldWidth = DEFAULT_GRID_WIDTH;
+    int worldHeight = DEFAULT_GRID_HEIGHT;
+    bool wantGpu = false;
+    const char* recordPath = nullptr;
+    uint64_t seed = ((uint64_t)std::random_device{}() << 32) | std::random_device{}();
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%dx%d", &worldWidth, &worldHeight) != 2 || worldWidth <= 0 || worldHeight <= 0) {
+                std::cerr << "bad size '" << argv[i] << "', expected WxH" << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--cell") == 0 && i + 1 < argc) {
+            cellSize = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--gpu") == 0) {
+            wantGpu = true;
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+    }
+    setRandomSeed(seed);
+    std::cout << "seed " << seed << std::endl;
+
     glfwInit();
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);                     
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, wantGpu ? 4 : 3);                     
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);                     
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-    GLFWwindow* window = glfwCreateWindow(w, h, "falling sand", nullptr, nullptr);
+    GLFWwindow* window = glfwCreateWindow(worldWidth * cellSize, worldHeight * cellSize, "falling sand", nullptr, nullptr);
+    if (!window && wantGpu) {
+        std::cerr << "no GL 4.3 context, running the simulation on the cpu" << std::endl;
+        wantGpu = false;
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        window = glfwCreateWindow(worldWidth * cellSize, worldHeight * cellSize, "falling sand", nullptr, nullptr);
+    }
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -408,12 +392,18 @@ int main() {
     glfwMakeContextCurrent(window);
     gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
 
-    unsigned int shaderProgram = createShaderProgram();
-    unsigned int projectionLoc = glGetUniformLocation(shaderProgram, "projection");
-    unsigned int colorLoc = glGetUniformLocation(shaderProgram, "color");
-
-    initializeGrid();
-    initializeRenderingResources();
+    resizeGrid(worldWidth, worldHeight);
+    initializeRenderer((GLADloadproc)glfwGetProcAddress);
+    if (wantGpu) {
+        gridOnGpu = initializeGpuSim((GLADloadproc)glfwGetProcAddress) && uploadGpuWorld();
+        if (!gridOnGpu) {
+            std::cerr << "running the simulation on the cpu" << std::endl;
+            recordCellWrites = false;
+        }
+    }
+    if (recordPath && startRecording(recordPath, gridOnGpu)) {
+        std::cout << "recording to " << recordPath << std::endl;
+    }
 
     glfwSetCursorPosCallback(window, cursorPositionCallback);
     glfwSetMouseButtonCallback(window, mouseButtonCallback);
@@ -427,30 +417,130 @@ int main() {
 
     glfwSwapInterval(1);
 
+    int newWidth = grid.width, newHeight = grid.height, newCellSize = cellSize;
+
+    //the cpu engines tick on the sim thread, the gpu one is driven from here since it needs the context
+    FixedTimestep gpuTimestep;
+    Snapshot gpuFrame;
+    if (!gridOnGpu) {
+        startSimThread();
+    }
+
     while (!glfwWindowShouldClose(window)) {
 
+        auto imguiStart = std::chrono::steady_clock::now();
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
         ImGuiIO& io = ImGui::GetIO();
         bool isMouseHandling = io.WantCaptureMouse;
         ImGui::Begin("Properties");;
-        ImGui::Text("any value except sand size can be changed (since its set during compile time)");
         ImGui::SliderFloat("lightness(lower is brighter)", &saturationLevel, 0.01f, 10.0f);
         ImGui::SliderFloat("color cycle speed", &speed, 0.1f, 12.0f);
         ImGui::SliderFloat("color change time", &colorChangeInterval, 0.01f, 10.0f);
         ImGui::ColorEdit3("background", (float*)&background_color);
-        ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 100.0f / io.Framerate, io.Framerate);
+        int material = currentMaterial;
+        if (ImGui::Combo("material", &material, [](void*, int i) { return MATERIALS[i].name; }, nullptr, MATERIAL_COUNT)) {
+            currentMaterial = (CellType)material;
+        }
+        ImGui::SliderInt("brush radius", &brushRadius, 0, MAX_BRUSH_RADIUS);
+        ImGui::Combo("brush shape", (int*)&brushShape, BRUSH_SHAPE_NAMES, BRUSH_SHAPE_COUNT);
+        ImGui::SliderFloat("brush density", &brushDensity, 0.01f, 1.0f);
+        ImGui::Checkbox("eraser (left button)", &erasing);
+        //the sim thread reads these between ticks, so they change under the lock
+        int engine = simEngine;
+        bool dirtyChunks = useDirtyChunks;
+        if (gridOnGpu) {
+            ImGui::Text("engine: gpu margolus");
+        }
+        else if (ImGui::Combo("engine", &engine, ENGINE_NAMES, ENGINE_COUNT)) {
+            std::lock_guard<std::mutex> lock(gridMutex);
+            simEngine = (SimEngine)engine;
+            recordEngine(simEngine, useDirtyChunks);
+        }
+        ImGui::Combo("renderer", (int*)&renderMode, RENDER_MODE_NAMES, RENDER_MODE_COUNT);
+        if (ImGui::Checkbox("only step awake chunks", &dirtyChunks)) {
+            std::lock_guard<std::mutex> lock(gridMutex);
+            useDirtyChunks = dirtyChunks;
+            recordEngine(simEngine, useDirtyChunks);
+        }
+        int rate = tickRate, substeps = maxSubsteps;
+        if (ImGui::SliderInt("ticks per second", &rate, 1, 1000)) {
+            tickRate = rate;
+        }
+        if (ImGui::SliderInt("max ticks per frame", &substeps, 1, 64)) {
+            maxSubsteps = substeps;
+        }
+
+        const Snapshot& frame = gridOnGpu ? gpuFrame : latestSnapshot();
+        ImGui::Text("simulation %.1f ticks/s", gridOnGpu ? gpuTimestep.measuredRate : frame.ticksPerSecond);
+        ImGui::Text("grid upload %.1f KB/frame", uploadBytes / 1024.0f);
+        if (!gridOnGpu && simEngine == ENGINE_ACTIVE) {
+            ImGui::Text("active particles: %d", frame.activeParticles);
+        }
+        else if (!gridOnGpu) {
+            ImGui::Text("awake chunks: %d / %d", frame.awakeChunks, grid.chunksX * grid.chunksY);
+        }
+        ImGui::InputInt("world width", &newWidth);
+        ImGui::InputInt("world height", &newHeight);
+        ImGui::InputInt("cell size", &newCellSize);
+        if (ImGui::Button("resize world (clears it)") && newWidth > 0 && newHeight > 0 && newCellSize > 0) {
+            applyWorldSize(window, newWidth, newHeight, newCellSize);
+        }
+        ImGui::InputText("world file", worldPath, sizeof(worldPath));
+        if (ImGui::Button("save world (F5)")) {
+            saveWorldFile();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("load world (F9)")) {
+            loadWorldFile(window);
+            newWidth = grid.width;
+            newHeight = grid.height;
+        }
+        ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
         ImGui::End();
+        profilerWindow();
+        recordStage(STAGE_IMGUI, millisecondsSince(imguiStart));
 
         if (leftmousePressed || rightmousePressed) {
             updateColor();
         }
-        updateSimulation();
+
+        if (gridOnGpu) {
+            int due = gpuTimestep.advance(tickRate, maxSubsteps, isPaused);
+            if (due == 0) {
+                drainBrushCommands();
+            }
+            for (int i = 0; i < due; ++i) {
+                beginGpuTimer(STAGE_GPU_SIMULATION);
+                {
+                    ProfileScope timing(STAGE_SIMULATION);
+                    drainBrushCommands();
+                    updateGpuSim();
+                    recordTick();
+                }
+                endGpuTimer();
+            }
+            gpuFrame.width = grid.width;
+            gpuFrame.height = grid.height;
+        }
+
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        glViewport(0, 0, framebufferWidth, framebufferHeight);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        renderGrid(shaderProgram, projectionLoc);
-        glfwPollEvents();
+        beginGpuTimer(STAGE_GPU_GRID);
+        if (gridOnGpu) {
+            applyGpuCellWrites();
+            fillGridTexture(gpuColorBuffer());
+        }
+        renderGrid(frame);
+        endGpuTimer();
+        {
+            ProfileScope timing(STAGE_INPUT);
+            glfwPollEvents();
+        }
 
         ImVec2 initialWindowSize(640, 350);
         /*ImVec2 windowPos(100, 100);
@@ -461,17 +551,37 @@ int main() {
 
         }
 
-        ImGui::Render();
-        glClearColor(background_color.x * background_color.w, background_color.y * background_color.w, background_color.z * background_color.w, background_color.w);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        glfwSwapBuffers(window);
+        {
+            ProfileScope timing(STAGE_IMGUI);
+            beginGpuTimer(STAGE_GPU_IMGUI);
+            ImGui::Render();
+            glClearColor(background_color.x * background_color.w, background_color.y * background_color.w, background_color.z * background_color.w, background_color.w);
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            endGpuTimer();
+        }
+        {
+            ProfileScope timing(STAGE_SWAP);
+            glfwSwapBuffers(window);
+        }
+        endProfileFrame();
+        collectGpuTimers();
     }
 
+    stopSimThread();
+    if (isRecording()) {
+        if (gridOnGpu) {
+            downloadGpuWorld();
+        }
+        stopRecording();
+    }
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
-    glDeleteProgram(shaderProgram);
+    if (gridOnGpu) {
+        shutdownGpuSim();
+    }
+    shutdownRenderer();
     glfwDestroyWindow(window);
     glfwTerminate();
 
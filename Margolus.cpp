@@ -0,0 +1,179 @@
+#include "Sim.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// the margolus engine cuts the grid into 2x2 blocks and replaces each block with its next state
+// in one lookup. the blocks start on even cells one tick and odd cells the next, so anything
+// that moves to the edge of its block is in the middle of a block on the following tick.
+// blocks never share cells, so they can be done in any order (or all at once): there is no
+// sweep direction for the result to lean towards.
+//
+// a block is four 2-bit material codes, so the engine covers the first four materials
+// (empty, sand, water, stone); a world with anything else in it runs serial instead.
+// the table maps each of the 256 blocks to where each of its four cells comes from, so colors
+// move along with the types
+
+static_assert(EMPTY < 4 && SAND < 4 && WATER < 4 && STONE < 4, "margolus blocks hold 2-bit materials");
+
+// cell order inside a block and inside the state byte (2 bits each, lowest first)
+enum BlockCell {
+    TOP_LEFT,
+    TOP_RIGHT,
+    BOTTOM_LEFT,
+    BOTTOM_RIGHT
+};
+
+// every destination reading from its own cell
+const uint8_t IDENTITY = TOP_LEFT | (TOP_RIGHT << 2) | (BOTTOM_LEFT << 4) | (BOTTOM_RIGHT << 6);
+
+constexpr bool falls(uint8_t material) {
+    return MATERIALS[material].behaviour == BEHAVIOUR_POWDER || MATERIALS[material].behaviour == BEHAVIOUR_LIQUID;
+}
+
+//static materials are the heaviest, so nothing sinks into them
+constexpr bool sinksInto(uint8_t mover, uint8_t cell) {
+    return falls(mover) && MATERIALS[cell].density < MATERIALS[mover].density;
+}
+
+// the same rules the row sweep uses, applied inside one block: each column falls (or sinks into
+// something lighter), then a grain that couldn't fall slides down the diagonal, then a liquid
+// that is still where it started slides along its row into an empty cell
+constexpr uint8_t blockRule(uint8_t state) {
+    uint8_t cells[4] = {};
+    uint8_t from[4] = { TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT };
+    bool moved[4] = {};
+    for (int i = 0; i < 4; ++i) {
+        cells[i] = (state >> (i * 2)) & 3;
+    }
+
+    auto swapCells = [&](int a, int b) {
+        uint8_t cell = cells[a];
+        cells[a] = cells[b];
+        cells[b] = cell;
+        uint8_t source = from[a];
+        from[a] = from[b];
+        from[b] = source;
+        moved[a] = true;
+        moved[b] = true;
+    };
+
+    for (int column = 0; column < 2; ++column) {
+        if (sinksInto(cells[column], cells[column + 2])) {
+            swapCells(column, column + 2);
+        }
+    }
+    if (!moved[TOP_LEFT] && !moved[BOTTOM_RIGHT] && sinksInto(cells[TOP_LEFT], cells[BOTTOM_RIGHT])) {
+        swapCells(TOP_LEFT, BOTTOM_RIGHT);
+    }
+    if (!moved[TOP_RIGHT] && !moved[BOTTOM_LEFT] && sinksInto(cells[TOP_RIGHT], cells[BOTTOM_LEFT])) {
+        swapCells(TOP_RIGHT, BOTTOM_LEFT);
+    }
+    for (int row = 0; row < 4; row += 2) {
+        int left = row;
+        int right = row + 1;
+        if (moved[left] || moved[right]) {
+            continue;
+        }
+        bool leftSlides = MATERIALS[cells[left]].behaviour == BEHAVIOUR_LIQUID && cells[right] == EMPTY;
+        bool rightSlides = MATERIALS[cells[right]].behaviour == BEHAVIOUR_LIQUID && cells[left] == EMPTY;
+        if (leftSlides || rightSlides) {
+            swapCells(left, right);
+        }
+    }
+
+    return from[0] | (from[1] << 2) | (from[2] << 4) | (from[3] << 6);
+}
+
+template <size_t... States>
+constexpr std::array<uint8_t, 256> makeBlockRules(std::index_sequence<States...>) {
+    return { { blockRule((uint8_t)States)... } };
+}
+
+// built by the compiler, indexed by the block's state byte
+constexpr std::array<uint8_t, 256> BLOCK_RULES = makeBlockRules(std::make_index_sequence<256>());
+
+static_assert(BLOCK_RULES[0] == IDENTITY, "an empty block stays put");
+static_assert(BLOCK_RULES[SAND] == (BOTTOM_LEFT | (TOP_RIGHT << 2) | (TOP_LEFT << 4) | (BOTTOM_RIGHT << 6)),
+    "a grain in the top left falls straight down");
+
+const uint8_t* margolusRules() {
+    return BLOCK_RULES.data();
+}
+
+static inline uint64_t load8(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// blocks with their bottom left corner on row y, starting at column offset. the span of blocks
+// that changed goes into painted
+static void updateBlockRow(int y, int offset, DirtyRect& painted) {
+    uint8_t* bottom = typeRow(y);
+    uint8_t* top = typeRow(y + 1);
+    uint32_t* bottomColors = colorRow(y);
+    uint32_t* topColors = colorRow(y + 1);
+
+    int firstChanged = grid.width;
+    int lastChanged = -1;
+    int x = offset;
+    while (x + 1 < grid.width) {
+        //8 empty columns in both rows are 4 blocks with nothing in them
+        if (x + 8 <= grid.width && load8(bottom + x) == 0 && load8(top + x) == 0) {
+            x += 8;
+            continue;
+        }
+
+        uint8_t state = top[x] | (top[x + 1] << 2) | (bottom[x] << 4) | (bottom[x + 1] << 6);
+        uint8_t rule = BLOCK_RULES[state];
+        if (rule != IDENTITY) {
+            uint8_t* types[4] = { &top[x], &top[x + 1], &bottom[x], &bottom[x + 1] };
+            uint32_t* colors[4] = { &topColors[x], &topColors[x + 1], &bottomColors[x], &bottomColors[x + 1] };
+            uint8_t oldTypes[4] = { *types[0], *types[1], *types[2], *types[3] };
+            uint32_t oldColors[4] = { *colors[0], *colors[1], *colors[2], *colors[3] };
+            for (int i = 0; i < 4; ++i) {
+                int source = (rule >> (i * 2)) & 3;
+                *types[i] = oldTypes[source];
+                *colors[i] = oldColors[source];
+            }
+            firstChanged = std::min(firstChanged, x);
+            lastChanged = x + 1;
+        }
+        x += 2;
+    }
+    if (lastChanged >= 0) {
+        expandRect(painted, firstChanged, y, lastChanged, y + 1);
+    }
+}
+
+// rows of blocks handed to one job at a time
+const int MARGOLUS_BAND = 16;
+
+// what each band changed. bands don't line up with chunk rows, so they're handed to paintCells
+// after the jobs are done
+static std::vector<DirtyRect> bandPainted;
+
+void updateMargolus() {
+    //grid.tick already counts this one, the first tick goes on the even blocks
+    int offset = (grid.tick - 1) & 1;
+    int blockRows = (grid.height - offset) / 2;
+    int bands = (blockRows + MARGOLUS_BAND - 1) / MARGOLUS_BAND;
+    bandPainted.assign(bands, EMPTY_RECT);
+    parallelFor(bands, [&](int band) {
+        int first = band * MARGOLUS_BAND;
+        int last = std::min(first + MARGOLUS_BAND, blockRows);
+        for (int blockRow = first; blockRow < last; ++blockRow) {
+            updateBlockRow(offset + blockRow * 2, offset, bandPainted[band]);
+        }
+    });
+    for (const DirtyRect& rect : bandPainted) {
+        if (rect.minX <= rect.maxX) {
+            paintCells(rect.minX, rect.minY, rect.maxX, rect.maxY);
+        }
+    }
+}
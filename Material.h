@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// every material a cell can hold, the value is what the type plane stores. EMPTY and SAND keep
+// the values they always had so grid hashes of sand-only worlds don't change
+enum CellType : uint8_t {
+    EMPTY,
+    SAND,
+    WATER,
+    STONE,
+    GAS,
+    MATERIAL_COUNT
+};
+
+// how a material moves, each gets its own update kernel
+enum MaterialBehaviour : uint8_t {
+    BEHAVIOUR_STATIC,   // never moves (empty cells, stone)
+    BEHAVIOUR_POWDER,   // falls straight down, then down-left, then down-right
+    BEHAVIOUR_LIQUID,   // falls like a powder, otherwise slides sideways
+    BEHAVIOUR_GAS       // rises like a powder falls, otherwise slides sideways
+};
+
+struct Material {
+    const char* name;
+    MaterialBehaviour behaviour;
+    uint8_t density;        // falling and rising materials swap places with lighter ones
+    uint8_t dispersion;     // how many cells a liquid or gas can slide sideways in one tick
+    uint8_t flammability;   // 0..255, nothing burns yet
+    uint32_t color;         // packed rgba8 for new cells, sand takes the brush color instead
+};
+
+// static materials have to be the heaviest, nothing can displace them
+constexpr Material MATERIALS[MATERIAL_COUNT] = {
+    { "empty", BEHAVIOUR_STATIC, 0,   0, 0,   0x00000000 },
+    { "sand",  BEHAVIOUR_POWDER, 3,   0, 0,   0xff80c8e6 },
+    { "water", BEHAVIOUR_LIQUID, 2,   4, 0,   0xffe08c28 },
+    { "stone", BEHAVIOUR_STATIC, 255, 0, 0,   0xff787878 },
+    { "gas",   BEHAVIOUR_GAS,    1,   4, 200, 0xffc8c8c8 },
+};
+
+// MATERIAL_COUNT if there is no material with that name
+inline CellType findMaterial(const char* name) {
+    for (int i = 0; i < MATERIAL_COUNT; ++i) {
+        if (std::strcmp(MATERIALS[i].name, name) == 0) {
+            return (CellType)i;
+        }
+    }
+    return MATERIAL_COUNT;
+}
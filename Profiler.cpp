@@ -0,0 +1,58 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+
+struct StageHistory {
+    std::atomic<float> samples[PROFILE_HISTORY];
+    std::atomic<unsigned> written;
+};
+
+static StageHistory history[STAGE_COUNT];
+//the frame being timed, main thread only
+static float frameTotals[STAGE_COUNT];
+
+static void pushSample(ProfileStage stage, float ms) {
+    StageHistory& stageHistory = history[stage];
+    unsigned at = stageHistory.written.load(std::memory_order_relaxed);
+    stageHistory.samples[at % PROFILE_HISTORY].store(ms, std::memory_order_relaxed);
+    stageHistory.written.store(at + 1, std::memory_order_release);
+}
+
+void recordStage(ProfileStage stage, float ms) {
+    if (stageIsPerFrame(stage)) {
+        frameTotals[stage] += ms;
+    }
+    else {
+        pushSample(stage, ms);
+    }
+}
+
+void endProfileFrame() {
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        if (stageIsPerFrame((ProfileStage)stage)) {
+            pushSample((ProfileStage)stage, frameTotals[stage]);
+            frameTotals[stage] = 0.0f;
+        }
+    }
+}
+
+int stageHistory(ProfileStage stage, float* samples) {
+    unsigned written = history[stage].written.load(std::memory_order_acquire);
+    int count = (int)std::min(written, (unsigned)PROFILE_HISTORY);
+    for (int i = 0; i < count; ++i) {
+        samples[i] = history[stage].samples[(written - count + i) % PROFILE_HISTORY].load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+float stagePercentile(ProfileStage stage, float p) {
+    float samples[PROFILE_HISTORY];
+    int count = stageHistory(stage, samples);
+    if (count == 0) {
+        return 0.0f;
+    }
+    int rank = std::min((int)(p / 100.0f * count), count - 1);
+    std::nth_element(samples, samples + rank, samples + count);
+    return samples[rank];
+}
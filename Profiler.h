@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+
+// where a frame goes, stage by stage. the cpu stages are timed with ProfileScope. everything but
+// simulation runs on the main thread and is summed over the frame, then closed with
+// endProfileFrame, so a stage that didn't run this frame gets a 0. simulation is one sample per
+// tick from whichever thread ticks. the gpu stages are GL_TIME_ELAPSED queries (Render.h) read
+// back a few frames late, so they never stall the pipeline.
+// the last PROFILE_HISTORY samples of every stage are kept for the plot and the percentiles, the
+// stores are atomic so the sim thread can record while the ui reads
+enum ProfileStage {
+    STAGE_INPUT,
+    STAGE_SIMULATION,
+    STAGE_INSTANCE_BUILD,
+    STAGE_UPLOAD,
+    STAGE_DRAW,
+    STAGE_IMGUI,
+    STAGE_SWAP,
+    STAGE_GPU_SIMULATION,
+    STAGE_GPU_GRID,
+    STAGE_GPU_IMGUI,
+    STAGE_COUNT
+};
+
+const char* const STAGE_NAMES[STAGE_COUNT] = {
+    "input", "simulation (per tick)", "instance build", "upload", "draw", "imgui", "swap",
+    "gpu simulation (per tick)", "gpu grid", "gpu imgui"
+};
+
+// stages that are summed over a frame, the others get a sample per run
+inline bool stageIsPerFrame(ProfileStage stage) {
+    return stage != STAGE_SIMULATION && stage < STAGE_GPU_SIMULATION;
+}
+
+const int PROFILE_HISTORY = 256;
+
+void recordStage(ProfileStage stage, float ms);
+void endProfileFrame();
+// copies the stage's history out oldest first, returns how many samples there were
+int stageHistory(ProfileStage stage, float* samples);
+// p in 0..100 over the history, 0 with no samples yet
+float stagePercentile(ProfileStage stage, float p);
+
+inline float millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct ProfileScope {
+    ProfileStage stage;
+    std::chrono::steady_clock::time_point start;
+
+    explicit ProfileScope(ProfileStage stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+    ~ProfileScope() {
+        recordStage(stage, millisecondsSince(start));
+    }
+};
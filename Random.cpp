@@ -0,0 +1,28 @@
+#include "Random.h"
+
+#include <atomic>
+
+static uint64_t seed = 0;
+static std::atomic<uint64_t> threadsSeen(0);
+
+void setRandomSeed(uint64_t newSeed) {
+    seed = newSeed;
+}
+
+uint64_t randomSeed() {
+    return seed;
+}
+
+RandomStream randomStream(uint64_t stream, uint64_t block) {
+    RandomStream random;
+    random.key[0] = (uint32_t)seed;
+    random.key[1] = (uint32_t)(seed >> 32);
+    random.stream = stream;
+    random.block = block;
+    return random;
+}
+
+RandomStream& threadRandom() {
+    thread_local RandomStream random = randomStream(STREAM_THREADS + threadsSeen++);
+    return random;
+}
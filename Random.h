@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+
+// counter-based random numbers (Philox4x32-10, Salmon et al. 2011). a block of four 32-bit
+// numbers is a pure function of the global seed (the key) and a 128-bit counter made of a stream
+// id and a position in that stream, so there is no shared state to fight over: every user takes
+// its own stream, any number of them draw in parallel, and a stream can be started at any
+// position. the same seed gives the same numbers on every machine and every run.
+//
+// streams are named by what they're for, so the ones the world uses replay exactly:
+//   STREAM_BRUSH         scatter directions and sparse brushes (Grid::brushRandom)
+//   STREAM_FUZZ          sand_diff's random worlds, a world's seed picks where in it to start
+//   STREAM_THREADS + n   threadRandom, for things that only need to be independent
+const uint64_t STREAM_BRUSH = 1;
+const uint64_t STREAM_FUZZ = 2;
+const uint64_t STREAM_THREADS = 1ull << 32;
+
+// set it before the world is built, streams made before keep the old key
+void setRandomSeed(uint64_t seed);
+uint64_t randomSeed();
+
+inline void philox4x32(uint32_t counter[4], const uint32_t key[2]) {
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; ++round) {
+        uint64_t product0 = (uint64_t)0xD2511F53u * counter[0];
+        uint64_t product1 = (uint64_t)0xCD9E8D57u * counter[2];
+        uint32_t next[4] = {
+            (uint32_t)(product1 >> 32) ^ counter[1] ^ k0,
+            (uint32_t)product1,
+            (uint32_t)(product0 >> 32) ^ counter[3] ^ k1,
+            (uint32_t)product0
+        };
+        counter[0] = next[0];
+        counter[1] = next[1];
+        counter[2] = next[2];
+        counter[3] = next[3];
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+}
+
+// one stream, four numbers per philox call. cheap to copy and to make, keep one per user
+struct RandomStream {
+    uint32_t key[2] = {};
+    uint64_t stream = 0;
+    uint64_t block = 0;
+    uint32_t buffer[4] = {};
+    int used = 4;
+
+    uint32_t next() {
+        if (used == 4) {
+            buffer[0] = (uint32_t)block;
+            buffer[1] = (uint32_t)(block >> 32);
+            buffer[2] = (uint32_t)stream;
+            buffer[3] = (uint32_t)(stream >> 32);
+            philox4x32(buffer, key);
+            ++block;
+            used = 0;
+        }
+        return buffer[used++];
+    }
+
+    // [0, 1)
+    float uniform() {
+        return (next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // [0, n)
+    int below(int n) {
+        return (int)(((uint64_t)next() * (uint32_t)n) >> 32);
+    }
+};
+
+// the stream with this id under the current seed, starting at the given block of four
+RandomStream randomStream(uint64_t stream, uint64_t block = 0);
+// a stream of the calling thread's own, made on first use
+RandomStream& threadRandom();
@@ -0,0 +1,583 @@
+#include "Render.h"
+#include "Profiler.h"
+#include "Sim.h"
+#include "SimThread.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+RenderMode renderMode = RENDER_TEXTURE;
+size_t uploadBytes = 0;
+bool gridOnGpu = false;
+
+static const char* vertexShaderSource = R"glsl(
+    #version 330 core
+layout(location = 0) in vec2 aPos; 
+layout(location = 1) in uvec2 instanceCell; 
+layout(location = 2) in vec4 instanceColor;    
+
+uniform mat4 projection;
+uniform float cellSize;
+
+out vec4 vColor; 
+
+void main() {
+    
+    gl_Position = projection * vec4(aPos + vec2(instanceCell) * cellSize, 0.0, 1.0);
+    vColor = instanceColor;
+}
+)glsl";
+
+static const char* fragmentShaderSource = R"glsl(
+    #version 330 core
+out vec4 FragColor;
+
+in vec4 vColor; 
+
+void main() {
+    FragColor = vColor;
+}
+)glsl";
+
+static unsigned int compileShader(unsigned int type, const char* source) {
+    unsigned int shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    return shader;
+}
+
+static unsigned int createShaderProgram(const char* vertexSource, const char* fragmentSource) {
+    unsigned int vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+    unsigned int fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    unsigned int shaderProgram = glCreateProgram();
+
+    glAttachShader(shaderProgram, vertexShader);
+    glAttachShader(shaderProgram, fragmentShader);
+    glLinkProgram(shaderProgram);
+
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    return shaderProgram;
+}
+
+static unsigned int shaderProgram = 0, projectionLoc = 0, cellSizeLoc = 0;
+static unsigned int VAO = 0, VBO = 0, instanceVBO=0;
+
+//8 bytes: the cell's grid coordinates, scaled by cellSize in the vertex shader, and its packed
+//rgba8 color as it is in the color plane, read as a normalized vec4
+struct InstanceData {
+    uint16_t x, y;
+    uint32_t color;
+};
+
+static_assert(sizeof(InstanceData) == 8, "instances are 8 bytes");
+
+//the instance buffer is a ring of three regions, one per frame in flight. a frame writes its
+//instances straight into its region and leaves a fence behind the draw, and the next frame to
+//use the region waits on that fence first, so the cpu never writes what the gpu is still reading.
+//with ARB_buffer_storage (core in 4.4) the whole buffer stays mapped for good, otherwise each
+//frame maps its region unsynchronized, which is safe for the same reason
+const int RING_REGIONS = 3;
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+static PFNGLBUFFERSTORAGEPROC bufferStorage = nullptr;
+
+static size_t regionInstances = 0;
+static unsigned char* persistentMapping = nullptr;
+static GLsync regionFences[RING_REGIONS] = {};
+static int ringRegion = 0;
+
+static bool hasExtension(const char* name) {
+    int count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (int i = 0; i < count; ++i) {
+        if (std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void waitForRegion(int region) {
+    if (!regionFences[region]) {
+        return;
+    }
+    //the first wait flushes, so the fence is sure to be reached
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(regionFences[region], flags, 1000000) == GL_TIMEOUT_EXPIRED) {
+        flags = 0;
+    }
+    glDeleteSync(regionFences[region]);
+    regionFences[region] = nullptr;
+}
+
+//(re)creates the ring with room for at least instances per region. buffer storage is immutable,
+//so growing means a new buffer either way
+static void allocateRing(size_t instances) {
+    for (int region = 0; region < RING_REGIONS; ++region) {
+        waitForRegion(region);
+    }
+    if (instanceVBO) {
+        glDeleteBuffers(1, &instanceVBO);
+    }
+    persistentMapping = nullptr;
+    regionInstances = std::max(instances, (size_t)1024);
+    GLsizeiptr bytes = (GLsizeiptr)(regionInstances * sizeof(InstanceData) * RING_REGIONS);
+
+    glGenBuffers(1, &instanceVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    if (bufferStorage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+        persistentMapping = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags);
+    }
+    else {
+        glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static int quadCellSize = 0;
+
+//the quad is one cell big, so it has to be uploaded again whenever cellSize changes
+static void uploadQuad() {
+    quadCellSize = cellSize;
+    float size = (float)cellSize;
+    float vertices[] = {
+        0.0f, 0.0f,
+        size, 0.0f,
+        size, size,
+        0.0f, size
+    };
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+}
+
+static void initializeInstancing(GLADloadproc loadProc) {
+    shaderProgram = createShaderProgram(vertexShaderSource, fragmentShaderSource);
+    projectionLoc = glGetUniformLocation(shaderProgram, "projection");
+    cellSizeLoc = glGetUniformLocation(shaderProgram, "cellSize");
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    
+
+    glBindVertexArray(VAO);
+
+    uploadQuad();
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+
+    //pos and col come from the ring, pointed at the frame's region when drawing
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1); 
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1); 
+
+    glBindVertexArray(0);
+
+    bool storage = hasExtension("GL_ARB_buffer_storage");
+    bufferStorage = storage ? (PFNGLBUFFERSTORAGEPROC)loadProc("glBufferStorage") : nullptr;
+    allocateRing((size_t)grid.width * grid.height / 4);
+}
+
+static void renderInstanced(const Snapshot& frame) {
+    uploadBytes = 0;
+    if (frame.width > MAX_GRID_SIDE || frame.height > MAX_GRID_SIDE) {
+        return;
+    }
+    if (quadCellSize != cellSize) {
+        glBindVertexArray(VAO);
+        uploadQuad();
+        glBindVertexArray(0);
+    }
+    glUseProgram(shaderProgram);
+    glUniform1f(cellSizeLoc, (float)cellSize);
+
+    glm::mat4 projection = glm::ortho(0.0f, (float)(frame.width * cellSize), 0.0f, (float)(frame.height * cellSize));
+    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+
+    //every filled cell is one instance, and the snapshot already knows how many that is
+    size_t count = frame.filled;
+    if (count == 0) {
+        glUseProgram(0);
+        return; 
+    }
+    if (count > regionInstances) {
+        allocateRing(count + count / 2);
+    }
+
+    int region = ringRegion;
+    ringRegion = (ringRegion + 1) % RING_REGIONS;
+    size_t regionOffset = (size_t)region * regionInstances * sizeof(InstanceData);
+    size_t bytes = count * sizeof(InstanceData);
+    InstanceData* instances;
+    {
+        ProfileScope timing(STAGE_UPLOAD);
+        waitForRegion(region);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        if (persistentMapping) {
+            instances = (InstanceData*)(persistentMapping + regionOffset);
+        }
+        else {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+            instances = (InstanceData*)glMapBufferRange(GL_ARRAY_BUFFER, regionOffset, bytes, flags);
+        }
+    }
+    if (!instances) {
+        glUseProgram(0);
+        return;
+    }
+
+    //giving the gpu instance data, written in place. the region only has room for count, so a
+    //color plane that disagrees with the counts can't write past it, and only what was written
+    //gets drawn
+    size_t written = 0;
+    {
+        ProfileScope timing(STAGE_INSTANCE_BUILD);
+        for (int y = 0; y < frame.height && written < count; ++y) {
+            const uint32_t* colors = frame.color.data() + (size_t)y * frame.width;
+            for (int x = 0; x < frame.width && written < count; ++x) {
+                if (colors[x] != 0) {
+                    instances[written++] = { (uint16_t)x, (uint16_t)y, colors[x] };
+                }
+            }
+        }
+    }
+    uploadBytes = written * sizeof(InstanceData);
+
+    bool intact;
+    {
+        ProfileScope timing(STAGE_UPLOAD);
+        intact = persistentMapping || glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+
+    ProfileScope timing(STAGE_DRAW);
+    glBindVertexArray(VAO);
+    glVertexAttribIPointer(1, 2, GL_UNSIGNED_SHORT, sizeof(InstanceData), (void*)(regionOffset + offsetof(InstanceData, x)));
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(InstanceData), (void*)(regionOffset + offsetof(InstanceData, color)));
+    if (intact) {
+        glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, (GLsizei)written);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    regionFences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glUseProgram(0);
+}
+
+//the quad covers the whole viewport and is made up from gl_VertexID, so it needs no vertex buffer
+static const char* textureVertexSource = R"glsl(
+    #version 330 core
+out vec2 uv;
+
+void main() {
+    vec2 corner = vec2(gl_VertexID == 1 || gl_VertexID == 2, gl_VertexID >= 2);
+    uv = corner;
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+)glsl";
+
+//empty cells have a zero color, alpha included, and let the background through
+static const char* textureFragmentSource = R"glsl(
+    #version 330 core
+uniform sampler2D gridTexture;
+
+in vec2 uv;
+out vec4 FragColor;
+
+void main() {
+    vec4 color = texture(gridTexture, uv);
+    if (color.a == 0.0) {
+        discard;
+    }
+    FragColor = color;
+}
+)glsl";
+
+static unsigned int textureProgram = 0, textureVAO = 0, gridTexture = 0;
+static int textureWidth = 0, textureHeight = 0;
+//the texture holds the snapshot with this sequence number, unless it is stale (new, or a snapshot
+//went by without being uploaded) and needs the whole frame
+static uint64_t textureSequence = 0;
+static bool textureStale = true;
+
+static void initializeTexture() {
+    textureProgram = createShaderProgram(textureVertexSource, textureFragmentSource);
+    glGenVertexArrays(1, &textureVAO);
+    glGenTextures(1, &gridTexture);
+}
+
+//(re)allocates the texture at the world size. the color plane is rgba8 with r in the lowest
+//byte, which is GL_RGBA / GL_UNSIGNED_BYTE byte for byte, and row 0 is the bottom like in gl.
+//false if the world is bigger than the largest texture
+static bool allocateTexture(int width, int height) {
+    if (width == textureWidth && height == textureHeight) {
+        return true;
+    }
+    static int refusedWidth = 0, refusedHeight = 0;
+    int maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if (width > maxSize || height > maxSize) {
+        if (width == refusedWidth && height == refusedHeight) {
+            return false;
+        }
+        refusedWidth = width;
+        refusedHeight = height;
+        std::cerr << "world is bigger than the largest texture (" << maxSize << "), drawing instanced quads";
+        if (width > MAX_GRID_SIDE || height > MAX_GRID_SIDE) {
+            std::cerr << ", which only reach " << MAX_GRID_SIDE << " cells a side";
+        }
+        std::cerr << std::endl;
+        return false;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, gridTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    textureWidth = width;
+    textureHeight = height;
+    textureStale = true;
+    return true;
+}
+
+static void uploadRect(const Snapshot& frame, const DirtyRect& rect) {
+    int width = rect.maxX - rect.minX + 1;
+    int height = rect.maxY - rect.minY + 1;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.minX, rect.minY, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+        frame.color.data() + (size_t)rect.minY * frame.width + rect.minX);
+    uploadBytes += (size_t)width * height * sizeof(uint32_t);
+}
+
+//only the boxes painted since the last snapshot go up, each straight out of the snapshot's color
+//plane with the row length set to its width. a settled world uploads nothing. leaves the texture bound
+static void uploadPainted(const Snapshot& frame) {
+    glBindTexture(GL_TEXTURE_2D, gridTexture);
+    uploadBytes = 0;
+    if (gridOnGpu || frame.sequence == textureSequence) {
+        return;
+    }
+    ProfileScope timing(STAGE_UPLOAD);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, frame.width);
+    if (textureStale) {
+        uploadRect(frame, { 0, 0, frame.width - 1, frame.height - 1 });
+        textureStale = false;
+    }
+    else {
+        for (const DirtyRect& rect : frame.painted) {
+            uploadRect(frame, rect);
+        }
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    textureSequence = frame.sequence;
+}
+
+static void renderTexture(const Snapshot& frame) {
+    uploadPainted(frame);
+
+    ProfileScope timing(STAGE_DRAW);
+    glUseProgram(textureProgram);
+    glBindVertexArray(textureVAO);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//one instance per cell of the grid texture. the vertex shader finds its cell from gl_InstanceID
+//and fetches the color itself; empty cells put all four corners on one point outside the clip
+//volume, so they're dropped before rasterization. nothing is built on the cpu
+static const char* pulledVertexSource = R"glsl(
+    #version 330 core
+uniform sampler2D gridTexture;
+uniform mat4 projection;
+uniform float cellSize;
+uniform int gridWidth;
+
+out vec4 vColor;
+
+void main() {
+    ivec2 cell = ivec2(gl_InstanceID % gridWidth, gl_InstanceID / gridWidth);
+    vec4 color = texelFetch(gridTexture, cell, 0);
+    vec2 corner = vec2(gl_VertexID == 1 || gl_VertexID == 2, gl_VertexID >= 2);
+    if (color.a == 0.0) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+    }
+    else {
+        gl_Position = projection * vec4((vec2(cell) + corner) * cellSize, 0.0, 1.0);
+    }
+    vColor = color;
+}
+)glsl";
+
+static unsigned int pulledProgram = 0, pulledProjectionLoc = 0, pulledCellSizeLoc = 0, pulledWidthLoc = 0;
+
+static void initializePulling() {
+    pulledProgram = createShaderProgram(pulledVertexSource, fragmentShaderSource);
+    pulledProjectionLoc = glGetUniformLocation(pulledProgram, "projection");
+    pulledCellSizeLoc = glGetUniformLocation(pulledProgram, "cellSize");
+    pulledWidthLoc = glGetUniformLocation(pulledProgram, "gridWidth");
+}
+
+static void renderPulled(const Snapshot& frame) {
+    uploadPainted(frame);
+
+    ProfileScope timing(STAGE_DRAW);
+    glUseProgram(pulledProgram);
+    glm::mat4 projection = glm::ortho(0.0f, (float)(frame.width * cellSize), 0.0f, (float)(frame.height * cellSize));
+    glUniformMatrix4fv(pulledProjectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform1f(pulledCellSizeLoc, (float)cellSize);
+    glUniform1i(pulledWidthLoc, frame.width);
+
+    //the texture path's vao, it has no attributes either
+    glBindVertexArray(textureVAO);
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, frame.width * frame.height);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void initializeRenderer(GLADloadproc loadProc) {
+    initializeInstancing(loadProc);
+    initializeTexture();
+    initializePulling();
+}
+
+void fillGridTexture(unsigned int buffer) {
+    if (!allocateTexture(grid.width, grid.height)) {
+        return;
+    }
+    ProfileScope timing(STAGE_UPLOAD);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glBindTexture(GL_TEXTURE_2D, gridTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, grid.width, grid.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void renderGrid(const Snapshot& frame) {
+    //nothing has been published yet
+    if (frame.width == 0 || frame.height == 0) {
+        uploadBytes = 0;
+        return;
+    }
+    bool textureFits = allocateTexture(frame.width, frame.height);
+    if (gridOnGpu) {
+        //the color plane is out of date, only the texture has the world
+        if (textureFits && renderMode == RENDER_PULLED) {
+            renderPulled(frame);
+        }
+        else if (textureFits) {
+            renderTexture(frame);
+        }
+        return;
+    }
+    if (renderMode == RENDER_TEXTURE && textureFits) {
+        renderTexture(frame);
+    }
+    else if (renderMode == RENDER_PULLED && textureFits) {
+        renderPulled(frame);
+    }
+    else {
+        renderInstanced(frame);
+        //the texture missed this snapshot's changes
+        if (frame.sequence != textureSequence) {
+            textureStale = true;
+        }
+    }
+}
+
+//queries handed out and not read back yet, oldest first, and ones ready for reuse
+struct GpuTimer {
+    GLuint query;
+    ProfileStage stage;
+};
+
+static std::deque<GpuTimer> pendingTimers;
+static std::vector<GLuint> freeQueries;
+static bool timerOpen = false;
+
+void beginGpuTimer(ProfileStage stage) {
+    if (timerOpen) {
+        return;
+    }
+    GLuint query;
+    if (freeQueries.empty()) {
+        glGenQueries(1, &query);
+    }
+    else {
+        query = freeQueries.back();
+        freeQueries.pop_back();
+    }
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    pendingTimers.push_back({ query, stage });
+    timerOpen = true;
+}
+
+void endGpuTimer() {
+    if (timerOpen) {
+        glEndQuery(GL_TIME_ELAPSED);
+        timerOpen = false;
+    }
+}
+
+void collectGpuTimers() {
+    //results come back in order, so stop at the first one that isn't in yet
+    while (!pendingTimers.empty() && (pendingTimers.size() > 1 || !timerOpen)) {
+        GpuTimer timer = pendingTimers.front();
+        GLuint available = 0;
+        glGetQueryObjectuiv(timer.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(timer.query, GL_QUERY_RESULT, &nanoseconds);
+        recordStage(timer.stage, nanoseconds / 1.0e6f);
+        freeQueries.push_back(timer.query);
+        pendingTimers.pop_front();
+    }
+}
+
+void shutdownRenderer() {
+    for (int region = 0; region < RING_REGIONS; ++region) {
+        waitForRegion(region);
+    }
+    glDeleteProgram(shaderProgram);
+    glDeleteProgram(textureProgram);
+    glDeleteProgram(pulledProgram);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &instanceVBO);
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteVertexArrays(1, &textureVAO);
+    glDeleteTextures(1, &gridTexture);
+    for (const GpuTimer& timer : pendingTimers) {
+        freeQueries.push_back(timer.query);
+    }
+    pendingTimers.clear();
+    if (!freeQueries.empty()) {
+        glDeleteQueries((GLsizei)freeQueries.size(), freeQueries.data());
+    }
+    freeQueries.clear();
+}
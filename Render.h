@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Profiler.h"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+struct Snapshot;
+
+// draws snapshots of the grid (SimThread.h) into the current GL 3.3 context (glad has to be
+// loaded first). the size of the world and the cell follow the snapshot and cellSize.
+//
+// instanced draws one quad per filled cell from 8-byte instances (16-bit cell coordinates), written
+// every frame straight into a persistently mapped ring buffer, three frames deep.
+// texture keeps the color plane in a width x height RGBA8 texture and draws a single quad over
+// the whole world with nearest sampling, so the draw costs the same however full the world is.
+// only the cells the snapshot says were painted are uploaded to it.
+// pulled draws a quad per cell like instanced, but the vertex shader reads the cells out of the
+// grid texture by gl_InstanceID, so the cpu builds nothing.
+// texture and pulled fall back to instanced when the world is bigger than the largest texture
+enum RenderMode {
+    RENDER_INSTANCED,
+    RENDER_TEXTURE,
+    RENDER_PULLED,
+    RENDER_MODE_COUNT
+};
+
+const char* const RENDER_MODE_NAMES[RENDER_MODE_COUNT] = { "instanced quads", "grid texture", "pulled quads" };
+
+extern RenderMode renderMode;
+// bytes sent to the gpu for the grid in the last renderGrid
+extern size_t uploadBytes;
+// set while the gpu backend owns the world: the grid texture is filled with fillGridTexture
+// instead of from the color plane, and instanced draws the texture instead
+extern bool gridOnGpu;
+
+// loadProc looks up entry points glad doesn't load (glBufferStorage), the same one glad was given
+void initializeRenderer(GLADloadproc loadProc);
+void renderGrid(const Snapshot& frame);
+// copies a buffer laid out like grid.color into the grid texture, on the gpu
+void fillGridTexture(unsigned int buffer);
+// GL_TIME_ELAPSED around the gl commands between the two calls, for the profiler. timers can't
+// overlap, a begin while one is open is ignored
+void beginGpuTimer(ProfileStage stage);
+void endGpuTimer();
+// hands the timers whose results are in to the profiler, call once a frame
+void collectGpuTimers();
+void shutdownRenderer();
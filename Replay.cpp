@@ -0,0 +1,357 @@
+#include "Replay.h"
+#include "Random.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+static const char REPLAY_MAGIC[7] = { 'S', 'A', 'N', 'D', 'L', 'O', 'G' };
+static const size_t REPLAY_HEADER_SIZE = 26;
+static const size_t RECORD_FLUSH_SIZE = 1 << 16;
+
+enum ReplayFlags {
+    REPLAY_DIRTY_CHUNKS = 1,
+    REPLAY_GPU = 2
+};
+
+static std::FILE* recordFile = nullptr;
+static std::vector<uint8_t> recordBuffer;
+static uint64_t pendingTicks = 0;
+
+static void putFixed(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.push_back((uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)value | 0x80);
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+//zigzag, so small negative numbers stay short
+static void putSigned(std::vector<uint8_t>& out, int64_t value) {
+    putVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static uint8_t engineFlags(bool dirtyChunks, bool gpu) {
+    return (dirtyChunks ? REPLAY_DIRTY_CHUNKS : 0) | (gpu ? REPLAY_GPU : 0);
+}
+
+static bool flushRecording() {
+    bool ok = std::fwrite(recordBuffer.data(), 1, recordBuffer.size(), recordFile) == recordBuffer.size();
+    recordBuffer.clear();
+    return ok;
+}
+
+static void beginEvent(ReplayEventKind kind) {
+    recordBuffer.push_back((uint8_t)kind);
+    putVarint(recordBuffer, pendingTicks);
+    pendingTicks = 0;
+}
+
+static void endEvent() {
+    if (recordBuffer.size() >= RECORD_FLUSH_SIZE && !flushRecording()) {
+        std::cerr << "could not write the session log, recording stopped" << std::endl;
+        std::fclose(recordFile);
+        recordFile = nullptr;
+    }
+}
+
+static bool storable(int width, int height) {
+    return width > 0 && height > 0 && width <= MAX_GRID_SIDE && height <= MAX_GRID_SIDE;
+}
+
+bool startRecording(const char* path, bool gpu) {
+    if (recordFile) {
+        stopRecording();
+    }
+    if (!storable(grid.width, grid.height)) {
+        std::cerr << "a " << grid.width << "x" << grid.height << " world is too big to record, session logs take up to "
+            << MAX_GRID_SIDE << " cells a side" << std::endl;
+        return false;
+    }
+    recordFile = std::fopen(path, "wb");
+    if (!recordFile) {
+        std::cerr << "could not open " << path << " to record to" << std::endl;
+        return false;
+    }
+    recordBuffer.clear();
+    for (char letter : REPLAY_MAGIC) {
+        recordBuffer.push_back((uint8_t)letter);
+    }
+    recordBuffer.push_back(REPLAY_VERSION);
+    putFixed(recordBuffer, randomSeed(), 8);
+    putFixed(recordBuffer, (uint32_t)grid.width, 4);
+    putFixed(recordBuffer, (uint32_t)grid.height, 4);
+    recordBuffer.push_back((uint8_t)(gpu ? ENGINE_MARGOLUS : simEngine));
+    recordBuffer.push_back(engineFlags(useDirtyChunks, gpu));
+    pendingTicks = 0;
+    return true;
+}
+
+bool isRecording() {
+    return recordFile != nullptr;
+}
+
+void recordBrushCommand(const BrushCommand& command) {
+    if (!recordFile) {
+        return;
+    }
+    bool sparse = command.density < 1.0f;
+    beginEvent(REPLAY_BRUSH);
+    putSigned(recordBuffer, command.fromX);
+    putSigned(recordBuffer, command.fromY);
+    putSigned(recordBuffer, (int64_t)command.toX - command.fromX);
+    putSigned(recordBuffer, (int64_t)command.toY - command.fromY);
+    putVarint(recordBuffer, (uint64_t)std::max(command.radius, 0));
+    recordBuffer.push_back((uint8_t)(command.tool | command.shape << 2 | (sparse ? 1 : 0) << 4));
+    recordBuffer.push_back((uint8_t)command.material);
+    putFixed(recordBuffer, command.color, 4);
+    if (sparse) {
+        uint32_t bits;
+        std::memcpy(&bits, &command.density, sizeof(bits));
+        putFixed(recordBuffer, bits, 4);
+    }
+    endEvent();
+}
+
+void recordTick() {
+    if (recordFile) {
+        ++pendingTicks;
+    }
+}
+
+void recordReset() {
+    if (!recordFile) {
+        return;
+    }
+    beginEvent(REPLAY_RESET);
+    endEvent();
+}
+
+static bool finishRecording(bool withHash) {
+    beginEvent(REPLAY_END);
+    recordBuffer.push_back(withHash ? 1 : 0);
+    putFixed(recordBuffer, withHash ? gridHash() : 0, 8);
+    bool ok = flushRecording();
+    ok = std::fclose(recordFile) == 0 && ok;
+    recordFile = nullptr;
+    if (!ok) {
+        std::cerr << "could not finish the session log" << std::endl;
+    }
+    return ok;
+}
+
+void recordResize(int width, int height) {
+    if (!recordFile) {
+        return;
+    }
+    if (!storable(width, height)) {
+        std::cerr << "a " << width << "x" << height << " world is too big for the session log, recording stopped" << std::endl;
+        finishRecording(false);
+        return;
+    }
+    beginEvent(REPLAY_RESIZE);
+    putVarint(recordBuffer, (uint64_t)width);
+    putVarint(recordBuffer, (uint64_t)height);
+    endEvent();
+}
+
+void recordEngine(SimEngine engine, bool dirtyChunks) {
+    if (!recordFile) {
+        return;
+    }
+    beginEvent(REPLAY_ENGINE);
+    recordBuffer.push_back((uint8_t)engine);
+    recordBuffer.push_back(engineFlags(dirtyChunks, false));
+    endEvent();
+}
+
+bool stopRecording() {
+    if (!recordFile) {
+        return false;
+    }
+    return finishRecording(true);
+}
+
+struct ReplayReader {
+    const uint8_t* at;
+    const uint8_t* end;
+    bool ok;
+};
+
+static uint64_t getFixed(ReplayReader& in, int bytes) {
+    if (in.end - in.at < bytes) {
+        in.ok = false;
+        return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= (uint64_t)in.at[i] << (8 * i);
+    }
+    in.at += bytes;
+    return value;
+}
+
+static uint64_t getVarint(ReplayReader& in) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in.at == in.end) {
+            break;
+        }
+        uint8_t byte = *in.at++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    in.ok = false;
+    return 0;
+}
+
+static int64_t getSigned(ReplayReader& in) {
+    uint64_t value = getVarint(in);
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+//a stroke is cut down to the grid and its radius before it's logged (drainBrushCommands)
+static bool reachesWorld(int64_t value, int size, uint64_t radius) {
+    return value >= -(int64_t)radius && value < size + (int64_t)radius;
+}
+
+bool loadReplay(const char* path, ReplayLog& log) {
+    std::FILE* file = std::fopen(path, "rb");
+    if (!file) {
+        std::cerr << "could not open session log " << path << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t block[1 << 16];
+    size_t got;
+    while ((got = std::fread(block, 1, sizeof(block), file)) > 0) {
+        bytes.insert(bytes.end(), block, block + got);
+    }
+    std::fclose(file);
+
+    if (bytes.size() < REPLAY_HEADER_SIZE || std::memcmp(bytes.data(), REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) != 0) {
+        std::cerr << path << " is not a session log" << std::endl;
+        return false;
+    }
+    if (bytes[7] != REPLAY_VERSION) {
+        std::cerr << path << " is a version " << (int)bytes[7] << " session log, this build reads version " << (int)REPLAY_VERSION << std::endl;
+        return false;
+    }
+    ReplayReader in = { bytes.data() + 8, bytes.data() + bytes.size(), true };
+    log.seed = getFixed(in, 8);
+    uint64_t width = getFixed(in, 4), height = getFixed(in, 4);
+    uint8_t engine = (uint8_t)getFixed(in, 1);
+    uint8_t flags = (uint8_t)getFixed(in, 1);
+    if (width == 0 || height == 0 || width > MAX_GRID_SIDE || height > MAX_GRID_SIDE || engine >= ENGINE_COUNT) {
+        std::cerr << path << " has a bad header" << std::endl;
+        return false;
+    }
+    log.width = (int)width;
+    log.height = (int)height;
+    log.engine = (SimEngine)engine;
+    log.dirtyChunks = (flags & REPLAY_DIRTY_CHUNKS) != 0;
+    log.gpu = (flags & REPLAY_GPU) != 0;
+    log.events.assign(bytes.begin() + REPLAY_HEADER_SIZE, bytes.end());
+    return true;
+}
+
+ReplayCursor beginReplay(const ReplayLog& log) {
+    setRandomSeed(log.seed);
+    simEngine = log.engine;
+    useDirtyChunks = log.dirtyChunks;
+    resizeGrid(log.width, log.height);
+    ReplayCursor cursor;
+    cursor.width = log.width;
+    cursor.height = log.height;
+    return cursor;
+}
+
+bool nextReplayEvent(const ReplayLog& log, ReplayCursor& cursor, ReplayEvent& event) {
+    if (cursor.offset >= log.events.size()) {
+        return false;
+    }
+    ReplayReader in = { log.events.data() + cursor.offset, log.events.data() + log.events.size(), true };
+    uint8_t kind = (uint8_t)getFixed(in, 1);
+    event.kind = (ReplayEventKind)kind;
+    event.ticksBefore = getVarint(in);
+    event.command = {};
+    event.hasHash = false;
+
+    bool valid = kind < REPLAY_KIND_COUNT;
+    if (kind == REPLAY_BRUSH) {
+        int64_t fromX = getSigned(in), fromY = getSigned(in);
+        int64_t toX = fromX + getSigned(in), toY = fromY + getSigned(in);
+        uint64_t radius = getVarint(in);
+        uint8_t bits = (uint8_t)getFixed(in, 1);
+        uint8_t material = (uint8_t)getFixed(in, 1);
+        event.command.color = (uint32_t)getFixed(in, 4);
+        event.command.density = 1.0f;
+        if (bits & 0x10) {
+            uint32_t density = (uint32_t)getFixed(in, 4);
+            std::memcpy(&event.command.density, &density, sizeof(density));
+        }
+        valid = radius <= MAX_BRUSH_RADIUS && reachesWorld(fromX, cursor.width, radius) && reachesWorld(toX, cursor.width, radius) &&
+            reachesWorld(fromY, cursor.height, radius) && reachesWorld(toY, cursor.height, radius) && (bits & 3) <= BRUSH_SCATTER && (bits >> 2 & 3) < BRUSH_SHAPE_COUNT && material < MATERIAL_COUNT;
+        event.command.fromX = (int)fromX;
+        event.command.fromY = (int)fromY;
+        event.command.toX = (int)toX;
+        event.command.toY = (int)toY;
+        event.command.radius = (int)radius;
+        event.command.tool = (BrushTool)(bits & 3);
+        event.command.shape = (BrushShape)(bits >> 2 & 3);
+        event.command.material = (CellType)material;
+    }
+    else if (kind == REPLAY_RESIZE) {
+        uint64_t width = getVarint(in), height = getVarint(in);
+        valid = width > 0 && height > 0 && width <= MAX_GRID_SIDE && height <= MAX_GRID_SIDE;
+        event.width = (int)width;
+        event.height = (int)height;
+    }
+    else if (kind == REPLAY_ENGINE) {
+        uint8_t engine = (uint8_t)getFixed(in, 1);
+        uint8_t flags = (uint8_t)getFixed(in, 1);
+        valid = engine < ENGINE_COUNT;
+        event.engine = (SimEngine)engine;
+        event.dirtyChunks = (flags & REPLAY_DIRTY_CHUNKS) != 0;
+    }
+    else if (kind == REPLAY_END) {
+        event.hasHash = getFixed(in, 1) != 0;
+        event.hash = getFixed(in, 8);
+    }
+    if (!in.ok || !valid) {
+        std::cerr << "session log is damaged at byte " << REPLAY_HEADER_SIZE + cursor.offset << std::endl;
+        cursor.offset = log.events.size();
+        return false;
+    }
+    if (kind == REPLAY_RESIZE) {
+        cursor.width = event.width;
+        cursor.height = event.height;
+    }
+    cursor.offset = in.at - log.events.data();
+    return true;
+}
+
+void applyReplayEvent(const ReplayEvent& event) {
+    if (event.kind == REPLAY_BRUSH) {
+        applyBrushCommand(event.command);
+    }
+    else if (event.kind == REPLAY_RESET) {
+        initializeGrid();
+    }
+    else if (event.kind == REPLAY_RESIZE) {
+        resizeGrid(event.width, event.height);
+    }
+    else if (event.kind == REPLAY_ENGINE) {
+        simEngine = event.engine;
+        useDirtyChunks = event.dirtyChunks;
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Brush.h"
+#include "Sim.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// session logs: everything that reached the world during a session, in the order it did, so a
+// run without a window can build the same world again as fast as it can step it.
+// input is logged where it lands rather than where the callbacks see it: the brush commands as
+// they're drained (already in grid cells, with the color and material they were made with), R's
+// reset, resizes and engine changes. between events only the number of ticks stepped is kept, so
+// the log doesn't care how fast the session ticked, whether it was paused or which engine ticked.
+// with the random seed in the header (Random.h) that's the whole state: the same log gives the
+// same grid bit for bit, and the hash at the end of the recording says whether it did.
+// a session ticked on the gpu is logged as margolus with the gpu flag set, the cpu engine steps
+// the same for the four block materials
+//
+// the file is little endian, a header and then events
+//   "SANDLOG" version:u8 seed:u64 width:i32 height:i32 engine:u8 flags:u8
+//   kind:u8 ticksBefore:varint ...
+// brush    fromX fromY toX-fromX toY-fromY (zigzag varints), radius:varint, tool | shape << 2 |
+//          sparse << 4 :u8, material:u8, color:u32, density:f32 only when sparse
+// reset    nothing
+// resize   width height (varints)
+// engine   engine:u8 flags:u8
+// end      hasHash:u8 hash:u64, the last event of a finished log
+// a brush stroke comes to 10-20 bytes, an hour at 60 ticks/s of idle ticking costs nothing
+enum ReplayEventKind {
+    REPLAY_BRUSH,
+    REPLAY_RESET,
+    REPLAY_RESIZE,
+    REPLAY_ENGINE,
+    REPLAY_END,
+    REPLAY_KIND_COUNT
+};
+
+const uint8_t REPLAY_VERSION = 1;
+
+// the recording side. every call but startRecording is a no-op while nothing is recorded, and
+// all of them have to be made with the grid locked (or from the thread that owns it), the same
+// as the changes they log. startRecording takes the header from the world as it is, so start it
+// right after the world is built. a log only holds worlds up to MAX_GRID_SIDE a side: starting
+// on a bigger one fails, resizing past it ends the log there without a hash to check against
+bool startRecording(const char* path, bool gpu);
+bool isRecording();
+void recordBrushCommand(const BrushCommand& command);
+void recordTick();
+void recordReset();
+void recordResize(int width, int height);
+void recordEngine(SimEngine engine, bool dirtyChunks);
+// writes the end with the hash of the grid as it is now and closes the file. with the gpu
+// engine running, download the world first
+bool stopRecording();
+
+struct ReplayLog {
+    uint64_t seed = 0;
+    int width = 0, height = 0;
+    SimEngine engine = ENGINE_SERIAL;
+    bool dirtyChunks = true;
+    bool gpu = false;
+    std::vector<uint8_t> events;
+};
+
+struct ReplayEvent {
+    ReplayEventKind kind;
+    uint64_t ticksBefore;
+    BrushCommand command;
+    int width, height;
+    SimEngine engine;
+    bool dirtyChunks;
+    bool hasHash;
+    uint64_t hash;
+};
+
+// where reading has got to in the events, and the size the world has there. brushes are only
+// taken within their radius of that world, so a damaged log can't ask for a stroke of millions
+// of rows
+struct ReplayCursor {
+    size_t offset = 0;
+    int width = 0, height = 0;
+};
+
+bool loadReplay(const char* path, ReplayLog& log);
+// sets the seed, the engine settings and the world the recording started from, and returns a
+// cursor on the first event
+ReplayCursor beginReplay(const ReplayLog& log);
+// decodes the event at the cursor and moves past it. false at the end of the events or on a
+// malformed one, which also ends the replay
+bool nextReplayEvent(const ReplayLog& log, ReplayCursor& cursor, ReplayEvent& event);
+// applies a brush, reset, resize or engine event to the world. the caller steps the ticks before
+// it, so it can tick whichever way it likes
+void applyReplayEvent(const ReplayEvent& event);
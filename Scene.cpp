@@ -0,0 +1,113 @@
+#include "Scene.h"
+#include "Sim.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+bool loadScene(const char* path, Scene& scene) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "could not open scene " << path << "\n";
+        return false;
+    }
+
+    initializeGrid();
+    scene.sources.clear();
+    currentMaterial = SAND;
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+
+        std::istringstream in(line);
+        std::string command;
+        if (!(in >> command)) {
+            continue;
+        }
+
+        bool ok = true;
+        if (command == "size") {
+            int width, height;
+            ok = static_cast<bool>(in >> width >> height) && width > 0 && height > 0;
+            if (ok) {
+                resizeGrid(width, height);
+            }
+        }
+        else if (command == "color") {
+            float r, g, b;
+            ok = static_cast<bool>(in >> r >> g >> b);
+            if (ok) {
+                currentColor = glm::vec4(r, g, b, 1.0f);
+            }
+        }
+        else if (command == "seed") {
+            unsigned long long seed;
+            ok = static_cast<bool>(in >> seed);
+            if (ok) {
+                setRandomSeed(seed);
+                grid.brushRandom = randomStream(STREAM_BRUSH);
+            }
+        }
+        else if (command == "material") {
+            std::string name;
+            ok = static_cast<bool>(in >> name) && findMaterial(name.c_str()) != MATERIAL_COUNT;
+            if (ok) {
+                currentMaterial = findMaterial(name.c_str());
+            }
+        }
+        else if (command == "fill") {
+            int x0, y0, x1, y1;
+            ok = static_cast<bool>(in >> x0 >> y0 >> x1 >> y1);
+            if (ok) {
+                uint32_t color = materialColor(currentMaterial, currentColor);
+                for (int y = std::max(y0, 0); y <= std::min(y1, grid.height - 1); ++y) {
+                    fillSpan(x0, x1, y, currentMaterial, color);
+                }
+            }
+        }
+        else if (command == "place" || command == "scatter") {
+            int px, py;
+            ok = static_cast<bool>(in >> px >> py);
+            if (ok) {
+                if (command == "place") {
+                    placeSand(px, py);
+                }
+                else {
+                    randomPlaceSand(px, py);
+                }
+            }
+        }
+        else if (command == "source") {
+            int x, y;
+            ok = static_cast<bool>(in >> x >> y);
+            if (ok) {
+                scene.sources.push_back({ x, y, currentMaterial, materialColor(currentMaterial, currentColor) });
+            }
+        }
+        else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << path << ":" << lineNumber << ": bad command '" << line << "'\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+void applySceneSources(const Scene& scene) {
+    for (const SceneSource& source : scene.sources) {
+        if (source.x >= 0 && source.x < grid.width && source.y >= 0 && source.y < grid.height) {
+            setCell(source.x, source.y, source.material, source.color);
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Material.h"
+
+#include <vector>
+
+// scene files are plain text, one command per line, '#' starts a comment.
+// grid coordinates have y = 0 at the bottom, window coordinates match the mouse callbacks.
+//
+//   size width height        resize the world (clears it, so put it first)
+//   color r g b              brush color for the following commands (0..1)
+//   material name            brush material for the following commands (a name from MATERIALS)
+//   seed n                   set the random seed (Random.h) and restart the brush's stream
+//   fill x0 y0 x1 y1         fill a grid rectangle (inclusive)
+//   place px py              placeSand at a window position
+//   scatter px py            randomPlaceSand at a window position
+//   source x y               drop one cell at grid cell (x, y) every tick
+
+struct SceneSource {
+    int x, y;
+    CellType material;
+    uint32_t color;
+};
+
+struct Scene {
+    std::vector<SceneSource> sources;
+};
+
+bool loadScene(const char* path, Scene& scene);
+void applySceneSources(const Scene& scene);
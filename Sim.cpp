@@ -0,0 +1,827 @@
+#include "Sim.h"
+#include "Brush.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+Grid grid;
+int cellSize = DEFAULT_CELL_SIZE;
+glm::vec4 currentColor = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+CellType currentMaterial = SAND;
+
+bool isPaused = false;
+bool useDirtyChunks = true;
+SimEngine simEngine = ENGINE_SERIAL;
+SimEngine steppedEngine = ENGINE_SERIAL;
+bool recordCellWrites = false;
+
+static std::vector<size_t> cellWrites;
+
+uint32_t packColor(const glm::vec4& color) {
+    glm::vec4 c = glm::clamp(color, 0.0f, 1.0f);
+    uint32_t r = (uint32_t)(c.r * 255.0f + 0.5f);
+    uint32_t g = (uint32_t)(c.g * 255.0f + 0.5f);
+    uint32_t b = (uint32_t)(c.b * 255.0f + 0.5f);
+    uint32_t a = (uint32_t)(c.a * 255.0f + 0.5f);
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+glm::vec4 unpackColor(uint32_t color) {
+    return glm::vec4(color & 0xff, (color >> 8) & 0xff, (color >> 16) & 0xff, color >> 24) / 255.0f;
+}
+
+uint32_t materialColor(CellType material, const glm::vec4& brush) {
+    return material == SAND ? packColor(brush) : MATERIALS[material].color;
+}
+
+//wakes a horizontal run of cells on one row, in the rect for this tick or the next one.
+//the run may straddle a chunk border, in which case both chunks wake up
+static inline void wakeRow(int x0, int x1, int y, bool now) {
+    if (y < 0 || y >= grid.height) {
+        return;
+    }
+    x0 = std::max(x0, 0);
+    x1 = std::min(x1, grid.width - 1);
+    Chunk* chunkRow = &chunkAt(0, y / CHUNK_SIZE);
+    for (int cx = x0 / CHUNK_SIZE; cx <= x1 / CHUNK_SIZE; ++cx) {
+        int spanStart = std::max(x0, cx * CHUNK_SIZE);
+        int spanEnd = std::min(x1, cx * CHUNK_SIZE + CHUNK_SIZE - 1);
+        expandRect(now ? chunkRow[cx].current : chunkRow[cx].next, spanStart, y, spanEnd, y);
+    }
+}
+
+void wakeCell(int x, int y) {
+    wakeRow(x, x, y, false);
+}
+
+void wakeAll() {
+    for (int cy = 0; cy < grid.chunksY; ++cy) {
+        for (int cx = 0; cx < grid.chunksX; ++cx) {
+            chunkAt(cx, cy).next = {
+                cx * CHUNK_SIZE, cy * CHUNK_SIZE,
+                std::min(cx * CHUNK_SIZE + CHUNK_SIZE, grid.width) - 1,
+                std::min(cy * CHUNK_SIZE + CHUNK_SIZE, grid.height) - 1
+            };
+        }
+    }
+}
+
+void setCell(int x, int y, CellType type, uint32_t color) {
+    --grid.materialCounts[grid.type[cellIndex(x, y)]];
+    ++grid.materialCounts[type];
+    grid.type[cellIndex(x, y)] = type;
+    grid.color[cellIndex(x, y)] = type == EMPTY ? 0 : color;
+    paintCells(x, y, x, y);
+    if (recordCellWrites) {
+        cellWrites.push_back(cellIndex(x, y));
+    }
+    if (grid.occupancyValid) {
+        uint64_t bit = 1ull << (x & 63);
+        uint64_t& word = occupancyRow(y)[x >> 6];
+        word = type == EMPTY ? word & ~bit : word | bit;
+    }
+    if (grid.activeValid) {
+        if (type == EMPTY) {
+            wakeActiveAbove(x, y);
+        }
+        else {
+            listActiveCell(x, y);
+        }
+    }
+    //liquids and gases next to the cell can care about it too, not just the grains above
+    for (int wakeY = y - 1; wakeY <= y + 1; ++wakeY) {
+        wakeRow(x - 1, x + 1, wakeY, false);
+    }
+}
+
+void fillSpan(int x0, int x1, int y, CellType type, uint32_t color) {
+    x0 = std::max(x0, 0);
+    x1 = std::min(x1, grid.width - 1);
+    if (y < 0 || y >= grid.height || x0 > x1) {
+        return;
+    }
+    size_t start = cellIndex(x0, y);
+    int count = x1 - x0 + 1;
+    uint8_t* types = grid.type + start;
+    //four histograms so a run of one material doesn't serialize on a single counter
+    uint32_t removed[4][MATERIAL_COUNT] = {};
+    int cell = 0;
+    for (; cell + 4 <= count; cell += 4) {
+        ++removed[0][types[cell]];
+        ++removed[1][types[cell + 1]];
+        ++removed[2][types[cell + 2]];
+        ++removed[3][types[cell + 3]];
+    }
+    for (; cell < count; ++cell) {
+        ++removed[0][types[cell]];
+    }
+    for (int material = 0; material < MATERIAL_COUNT; ++material) {
+        grid.materialCounts[material] -= removed[0][material] + removed[1][material] + removed[2][material] + removed[3][material];
+    }
+    grid.materialCounts[type] += count;
+    std::memset(types, type, count);
+    std::fill(grid.color + start, grid.color + start + count, type == EMPTY ? 0 : color);
+    paintCells(x0, y, x1, y);
+    if (recordCellWrites) {
+        for (int i = 0; i < count; ++i) {
+            cellWrites.push_back(start + i);
+        }
+    }
+    if (grid.occupancyValid) {
+        uint64_t* words = occupancyRow(y);
+        for (int word = x0 >> 6; word <= x1 >> 6; ++word) {
+            int from = std::max(x0 - word * 64, 0);
+            int to = std::min(x1 - word * 64, 63);
+            uint64_t bits = (to == 63 ? ~0ull : (1ull << (to + 1)) - 1) & ~((1ull << from) - 1);
+            words[word] = type == EMPTY ? words[word] & ~bits : words[word] | bits;
+        }
+    }
+    if (grid.activeValid) {
+        for (int x = x0; x <= x1; ++x) {
+            if (type == EMPTY) {
+                wakeActiveAbove(x, y);
+            }
+            else {
+                listActiveCell(x, y);
+            }
+        }
+    }
+    for (int wakeY = y - 1; wakeY <= y + 1; ++wakeY) {
+        wakeRow(x0 - 1, x1 + 1, wakeY, false);
+    }
+}
+
+//a checkerboard pass steps every chunk of one colour at once, one job per chunk. wakes that land
+//outside the job's own chunk are queued in its outbox and applied between passes, so a job never
+//writes another chunk's rects
+struct PendingWake {
+    int x0, x1, y;
+    bool now;
+};
+
+struct ChunkJob {
+    int pass;
+    int x0, y0, x1, y1;
+    Chunk* chunk;
+    std::vector<PendingWake>* outbox;
+    std::vector<size_t>* flagged;
+};
+
+//one per chunk, sized with the grid
+static std::vector<std::vector<PendingWake>> outboxes;
+static std::vector<std::vector<size_t>> chunkFlagged;
+
+//set on a cell that moved somewhere the sweep hasn't reached yet (a gas rising, a liquid sliding
+//right, a grain crossing into a chunk that is stepped later), so it isn't moved a second time.
+//the sweep clears it when it gets there, anything it never reaches is cleared at the end of the tick
+const uint8_t MOVED_FLAG = 0x80;
+static std::vector<size_t> serialFlagged;
+
+//a liquid or gas reads and writes up to its dispersion into the neighbouring chunks. two chunks
+//stepped at the same time are a whole chunk apart, so that has to stay under half a chunk
+static_assert(MATERIALS[WATER].dispersion < CHUNK_SIZE / 2 && MATERIALS[GAS].dispersion < CHUNK_SIZE / 2,
+    "dispersion has to stay under half a chunk for the threaded engine");
+
+//the sweep comes in two builds. Mixed = false is for worlds where sand is the only thing that
+//moves (everything else is empty or static), which is the plain falling sand loop. Mixed = true
+//handles everything: swaps with lighter materials, liquids and gases caring about more
+//neighbours than sand does (so moves wake more cells and row 0 is swept too), and cells landing
+//where the sweep hasn't been yet
+static bool mixedWorld = false;
+
+static inline int chunkPass(int cx, int cy) {
+    return (cx & 1) | ((cy & 1) << 1);
+}
+
+template <bool Threaded>
+static inline void wakeRowFrom(ChunkJob* job, int x0, int x1, int y, bool now) {
+    if constexpr (Threaded) {
+        if (y >= job->y0 && y <= job->y1 && x0 >= job->x0 && x1 <= job->x1) {
+            expandRect(now ? job->chunk->current : job->chunk->next, x0, y, x1, y);
+        }
+        else {
+            job->outbox->push_back({ x0, x1, y, now });
+        }
+    }
+    else {
+        wakeRow(x0, x1, y, now);
+    }
+}
+
+//true if the sweep still has to get to (toX, toY) this tick, coming from (x, y)
+template <bool Threaded>
+static inline bool reachedLater(ChunkJob* job, int x, int y, int toX, int toY) {
+    bool later = toY > y || (toY == y && toX > x);
+    if constexpr (Threaded) {
+        bool leftChunk = toX < job->x0 || toX > job->x1 || toY < job->y0 || toY > job->y1;
+        if (leftChunk) {
+            return chunkPass(toX / CHUNK_SIZE, toY / CHUNK_SIZE) > job->pass;
+        }
+    }
+    return later;
+}
+
+//a cell only ever needs checking again if it moved, or if something next to it was emptied.
+//sand only cares about the three cells under it: the emptied cell's row is still being swept
+//upwards, so the cells above it can take its place in this same tick. liquids and gases also
+//care about the cells beside and under them; the ones the sweep already passed wait a tick.
+//the mover swaps with what was there, which is empty or something lighter
+template <bool Threaded, bool Mixed>
+static inline void moveCell(ChunkJob* job, int x, int y, int toX, int toY) {
+    size_t from = cellIndex(x, y);
+    size_t to = cellIndex(toX, toY);
+    uint8_t displaced = Mixed ? grid.type[to] & ~MOVED_FLAG : EMPTY;
+    uint32_t displacedColor = Mixed ? grid.color[to] : 0;
+    grid.type[to] = grid.type[from];
+    grid.color[to] = grid.color[from];
+    grid.type[from] = displaced;
+    grid.color[from] = displacedColor;
+    wakeRowFrom<Threaded>(job, toX, toX, toY, false);
+    wakeRowFrom<Threaded>(job, x - 1, x + 1, y + 1, true);
+    if constexpr (Mixed) {
+        wakeRowFrom<Threaded>(job, x + 1, x + 1, y, true);
+        wakeRowFrom<Threaded>(job, x - 1, x, y, false);
+        wakeRowFrom<Threaded>(job, x - 1, x + 1, y - 1, false);
+    }
+
+    if constexpr (!Mixed) {
+        //sand only goes down, the only place the sweep hasn't been is a chunk stepped later.
+        //row 0 is never swept here, nothing there can move
+        if constexpr (Threaded) {
+            bool leftChunk = toX < job->x0 || toX > job->x1 || toY < job->y0;
+            if (leftChunk && toY > 0 && chunkPass(toX / CHUNK_SIZE, toY / CHUNK_SIZE) > job->pass) {
+                grid.type[to] |= MOVED_FLAG;
+                job->outbox->push_back({ toX, toX, toY, true });
+            }
+        }
+    }
+    else if (reachedLater<Threaded>(job, x, y, toX, toY)) {
+        grid.type[to] |= MOVED_FLAG;
+        if constexpr (Threaded) {
+            job->flagged->push_back(to);
+            bool leftChunk = toX < job->x0 || toX > job->x1 || toY < job->y0 || toY > job->y1;
+            if (leftChunk) {
+                job->outbox->push_back({ toX, toX, toY, true });
+            }
+        }
+        else {
+            serialFlagged.push_back(to);
+        }
+    }
+}
+
+static void clearMovedFlags(std::vector<size_t>& flagged) {
+    for (size_t index : flagged) {
+        grid.type[index] &= ~MOVED_FLAG;
+    }
+    flagged.clear();
+}
+
+//planes are cache-line aligned; anything big enough to matter is aligned to 2MB and handed to
+//transparent huge pages so a multi-gigabyte world isn't spread over millions of 4K tlb entries
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static void* allocPlane(size_t bytes) {
+    size_t alignment = bytes >= 4 * HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : 64;
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+#if defined(_WIN32)
+    return _aligned_malloc(bytes, alignment);
+#else
+    void* plane = nullptr;
+    if (posix_memalign(&plane, alignment, bytes) != 0) {
+        return nullptr;
+    }
+#if defined(MADV_HUGEPAGE)
+    if (alignment == HUGE_PAGE_SIZE) {
+        madvise(plane, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    return plane;
+#endif
+}
+
+static void freePlane(void* plane) {
+#if defined(_WIN32)
+    _aligned_free(plane);
+#else
+    std::free(plane);
+#endif
+}
+
+void resizeGrid(int width, int height) {
+    freePlane(grid.type);
+    freePlane(grid.color);
+    freePlane(grid.occupancy);
+    freePlane(grid.activeState);
+    delete[] grid.chunks;
+
+    grid.width = width;
+    grid.height = height;
+    grid.chunksX = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    grid.chunksY = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    grid.occupancyWords = (width + 63) / 64;
+
+    size_t cells = (size_t)width * height;
+    grid.type = (uint8_t*)allocPlane(cells);
+    grid.color = (uint32_t*)allocPlane(cells * sizeof(uint32_t));
+    grid.occupancy = (uint64_t*)allocPlane((size_t)height * grid.occupancyWords * sizeof(uint64_t));
+    grid.activeState = (uint8_t*)allocPlane(cells);
+    grid.chunks = new Chunk[(size_t)grid.chunksX * grid.chunksY];
+    outboxes.assign((size_t)grid.chunksX * grid.chunksY, {});
+    chunkFlagged.assign((size_t)grid.chunksX * grid.chunksY, {});
+
+    initializeGrid();
+}
+
+void initializeGrid() {
+    if (!grid.type) {
+        resizeGrid(DEFAULT_GRID_WIDTH, DEFAULT_GRID_HEIGHT);
+        return;
+    }
+    size_t cells = (size_t)grid.width * grid.height;
+    std::memset(grid.type, EMPTY, cells);
+    std::memset(grid.color, 0, cells * sizeof(uint32_t));
+    for (int i = 0; i < grid.chunksX * grid.chunksY; ++i) {
+        grid.chunks[i] = { EMPTY_RECT, EMPTY_RECT, EMPTY_RECT };
+    }
+    paintCells(0, 0, grid.width - 1, grid.height - 1);
+    std::memset(grid.occupancy, 0, (size_t)grid.height * grid.occupancyWords * sizeof(uint64_t));
+    grid.occupancyValid = true;
+    grid.activeValid = false;
+    std::fill(grid.materialCounts, grid.materialCounts + MATERIAL_COUNT, 0);
+    grid.materialCounts[EMPTY] = cells;
+    grid.tick = 0;
+    grid.brushRandom = randomStream(STREAM_BRUSH);
+}
+
+//add ( && grid.type[cellIndex(gridX, gridY - 1)] == EMPTY to all if statements to stop drawing on pre-existing sand)
+
+void placeSand(int mouseX, int mouseY) {
+    placeCell(mouseX / cellSize, (grid.height - 1) - mouseY / cellSize,
+        currentMaterial, materialColor(currentMaterial, currentColor));
+}
+
+void randomPlaceSand(int mouseX, int mouseY) {
+    scatterCell(mouseX / cellSize, (grid.height - 1) - mouseY / cellSize,
+        currentMaterial, materialColor(currentMaterial, currentColor));
+}
+
+void placeCell(int gridX, int gridY, CellType material, uint32_t color) {
+    BrushCommand command = {};
+    command.fromX = command.toX = gridX;
+    command.fromY = command.toY = gridY;
+    command.radius = 0;
+    command.shape = BRUSH_CIRCLE;
+    command.density = 1.0f;
+    command.color = color;
+    command.material = material;
+    command.tool = BRUSH_PAINT;
+    applyBrushCommand(command);
+}
+
+void scatterCell(int gridX, int gridY, CellType material, uint32_t color) {
+    if (gridX < 0 || gridX >= grid.width || gridY < 0 || gridY >= grid.height) {
+        return;
+    }
+    int direction = grid.brushRandom.below(3);
+
+    if (direction == 0) {
+        if (gridY + 2 < grid.height) {
+            setCell(gridX, gridY + 2, material, color);
+        }
+    }
+    else if (direction == 1) {
+        if (gridX - 1 >= 0 && gridY + 1 < grid.height) {
+            setCell(gridX - 1, gridY + 1, material, color);
+        }
+    }
+    else if (direction == 2) {
+        if (gridX + 1 < grid.width && gridY + 1 < grid.height) {
+            setCell(gridX + 1, gridY + 1, material, color);
+        }
+    }
+}
+
+static inline uint64_t load8(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+//true if any of the 8 bytes is EMPTY (0)
+static inline bool hasEmptyByte(uint64_t v) {
+    return ((v - 0x0101010101010101ull) & ~v & 0x8080808080808080ull) != 0;
+}
+
+//true if a Type cell moving into this cell can swap places with what's there. with sand the only
+//thing moving, only empty cells qualify
+template <uint8_t Type, bool Mixed>
+static inline bool canDisplace(uint8_t cell) {
+    if constexpr (Mixed) {
+        return cell == EMPTY || MATERIALS[cell & ~MOVED_FLAG].density < MATERIALS[Type].density;
+    }
+    return cell == EMPTY;
+}
+
+//straight down, then down-left, then down-right. gases pass the row above and dy = 1
+template <uint8_t Type, bool Threaded, bool Mixed>
+static inline bool moveVertical(ChunkJob* job, const uint8_t* next, int x, int y, int dy) {
+    if (canDisplace<Type, Mixed>(next[x])) {
+        moveCell<Threaded, Mixed>(job, x, y, x, y + dy);
+        return true;
+    }
+    else if (x > 0 && canDisplace<Type, Mixed>(next[x - 1])) {
+        moveCell<Threaded, Mixed>(job, x, y, x - 1, y + dy);
+        return true;
+    }
+    else if (x < grid.width - 1 && canDisplace<Type, Mixed>(next[x + 1])) {
+        moveCell<Threaded, Mixed>(job, x, y, x + 1, y + dy);
+        return true;
+    }
+    return false;
+}
+
+//slides as far as the material's dispersion along empty cells of the row, trying the side this
+//tick prefers first
+template <uint8_t Type, bool Threaded, bool Mixed>
+static inline bool moveSideways(ChunkJob* job, const uint8_t* row, int x, int y) {
+    int first = ((x + y + grid.tick) & 1) ? 1 : -1;
+    for (int dir : { first, -first }) {
+        int toX = x;
+        for (int step = 0; step < MATERIALS[Type].dispersion; ++step) {
+            int nextX = toX + dir;
+            if (nextX < 0 || nextX >= grid.width || row[nextX] != EMPTY) {
+                break;
+            }
+            toX = nextX;
+        }
+        if (toX != x) {
+            moveCell<Threaded, Mixed>(job, x, y, toX, y);
+            return true;
+        }
+    }
+    return false;
+}
+
+//one kernel per material, built from its row in MATERIALS at compile time. below is null on row 0
+template <uint8_t Type, bool Threaded, bool Mixed>
+static void updateMaterial(ChunkJob* job, uint8_t* row, const uint8_t* below, int x, int y) {
+    constexpr MaterialBehaviour behaviour = MATERIALS[Type].behaviour;
+    if constexpr (behaviour == BEHAVIOUR_POWDER) {
+        if (y > 0) {
+            moveVertical<Type, Threaded, Mixed>(job, below, x, y, -1);
+        }
+    }
+    else if constexpr (behaviour == BEHAVIOUR_LIQUID) {
+        if (y > 0 && moveVertical<Type, Threaded, Mixed>(job, below, x, y, -1)) {
+            return;
+        }
+        moveSideways<Type, Threaded, Mixed>(job, row, x, y);
+    }
+    else if constexpr (behaviour == BEHAVIOUR_GAS) {
+        if (y + 1 < grid.height && moveVertical<Type, Threaded, Mixed>(job, row + grid.width, x, y, 1)) {
+            return;
+        }
+        moveSideways<Type, Threaded, Mixed>(job, row, x, y);
+    }
+}
+
+typedef void (*CellKernel)(ChunkJob* job, uint8_t* row, const uint8_t* below, int x, int y);
+
+template <bool Threaded, bool Mixed, size_t... Types>
+static constexpr std::array<CellKernel, MATERIAL_COUNT> makeKernels(std::index_sequence<Types...>) {
+    return { { updateMaterial<(uint8_t)Types, Threaded, Mixed>... } };
+}
+
+//jump table indexed by the type byte
+template <bool Threaded, bool Mixed>
+static constexpr std::array<CellKernel, MATERIAL_COUNT> KERNELS = makeKernels<Threaded, Mixed>(std::make_index_sequence<MATERIAL_COUNT>());
+
+template <bool Threaded, bool Mixed>
+static inline void updateCell(ChunkJob* job, uint8_t* row, const uint8_t* below, int x, int y) {
+    uint8_t cell = row[x];
+    if ((Threaded || Mixed) && (cell & MOVED_FLAG)) {
+        row[x] = cell & ~MOVED_FLAG;
+        return;
+    }
+    //most of a world is sand, so it stays inline instead of going through the table
+    if (cell == SAND) {
+        moveVertical<SAND, Threaded, Mixed>(job, below, x, y, -1);
+    }
+    else if (cell != EMPTY) {
+        KERNELS<Threaded, Mixed>[cell](job, row, below, x, y);
+    }
+}
+
+//updates row y from x0 up to the end of the chunk's dirty rect, 8 cells at a time where possible:
+//skips runs of air, and when only sand moves, runs where all 10 cells underneath are filled (moves
+//earlier in the row only ever fill the row below, so the skip stays exact). in a mixed world the
+//rect is re-read as it goes, a liquid sliding right can grow it
+template <bool Threaded, bool Mixed>
+static void updateRowSpan(ChunkJob* job, int y, int x0, int spanEnd, const DirtyRect& rect) {
+    uint8_t* row = typeRow(y);
+    int x1 = std::min(rect.maxX, spanEnd);
+
+    //the floor: sand can't go anywhere, liquids and gases still can
+    if (y == 0) {
+        for (int x = x0; x <= std::min(rect.maxX, spanEnd); ++x) {
+            uint8_t cell = row[x];
+            if (cell & MOVED_FLAG) {
+                row[x] = cell & ~MOVED_FLAG;
+            }
+            else if (cell != EMPTY && cell != SAND) {
+                KERNELS<Threaded, Mixed>[cell](job, row, nullptr, x, y);
+            }
+        }
+        return;
+    }
+
+    const uint8_t* below = typeRow(y - 1);
+    int x = x0;
+    if (x == 0) {
+        updateCell<Threaded, Mixed>(job, row, below, 0, y);
+        x = 1;
+    }
+    for (; x + 8 <= x1 + 1 && x + 9 <= grid.width; x += 8) {
+        uint64_t cells = load8(row + x);
+        if (cells == 0) {
+            continue;
+        }
+        bool flagged = (Threaded || Mixed) && (cells & 0x8080808080808080ull) != 0;
+        if (!Mixed && !flagged && !hasEmptyByte(load8(below + x - 1)) && !hasEmptyByte(load8(below + x + 1))) {
+            continue;
+        }
+        for (int i = x; i < x + 8; ++i) {
+            updateCell<Threaded, Mixed>(job, row, below, i, y);
+        }
+        if constexpr (Mixed) {
+            x1 = std::min(rect.maxX, spanEnd);
+        }
+    }
+    for (; x <= x1; ++x) {
+        updateCell<Threaded, Mixed>(job, row, below, x, y);
+        if constexpr (Mixed) {
+            x1 = std::min(rect.maxX, spanEnd);
+        }
+    }
+}
+
+template <bool Mixed>
+static void updateSerialRows() {
+    //one sweep over whole rows from the bottom up, so cells are visited in exactly the same
+    //order as a full scan; a row just skips the chunks whose dirty rect doesn't cover it.
+    //row 0 is the floor, only liquids and gases can move there
+    for (int y = Mixed ? 0 : 1; y < grid.height; ++y) {
+        Chunk* chunkRow = &chunkAt(0, y / CHUNK_SIZE);
+        for (int cx = 0; cx < grid.chunksX; ++cx) {
+            const DirtyRect& rect = chunkRow[cx].current;
+            if (y < rect.minY || y > rect.maxY) {
+                continue;
+            }
+            int x0 = std::max(rect.minX, cx * CHUNK_SIZE);
+            int spanEnd = std::min(cx * CHUNK_SIZE + CHUNK_SIZE, grid.width) - 1;
+            updateRowSpan<false, Mixed>(nullptr, y, x0, spanEnd, rect);
+        }
+    }
+}
+
+static void updateSerial() {
+    if (mixedWorld) {
+        updateSerialRows<true>();
+    }
+    else {
+        updateSerialRows<false>();
+    }
+    clearMovedFlags(serialFlagged);
+}
+
+template <bool Mixed>
+static void updateChunk(int cx, int cy, int pass) {
+    Chunk& chunk = chunkAt(cx, cy);
+    size_t index = (size_t)cy * grid.chunksX + cx;
+    ChunkJob job = {
+        pass,
+        cx * CHUNK_SIZE, cy * CHUNK_SIZE,
+        std::min(cx * CHUNK_SIZE + CHUNK_SIZE, grid.width) - 1,
+        std::min(cy * CHUNK_SIZE + CHUNK_SIZE, grid.height) - 1,
+        &chunk, &outboxes[index], &chunkFlagged[index]
+    };
+    //the rect can still grow upwards while we sweep, so re-read it every row
+    for (int y = std::max(chunk.current.minY, std::max(job.y0, Mixed ? 0 : 1)); y <= std::min(chunk.current.maxY, job.y1); ++y) {
+        int x0 = std::max(chunk.current.minX, job.x0);
+        updateRowSpan<true, Mixed>(&job, y, x0, job.x1, chunk.current);
+    }
+}
+
+//the other colours' chunks wait between passes, so a cell (moving at most its dispersion) can
+//never reach a cell another job of the same colour is touching. same-colour chunks are 32 cells apart
+static void updateThreaded() {
+    std::vector<int> passChunks;
+    std::vector<int> steppedChunks;
+    for (int pass = 0; pass < 4; ++pass) {
+        passChunks.clear();
+        for (int cy = pass >> 1; cy < grid.chunksY; cy += 2) {
+            for (int cx = pass & 1; cx < grid.chunksX; cx += 2) {
+                const DirtyRect& rect = chunkAt(cx, cy).current;
+                if (rect.minX <= rect.maxX) {
+                    passChunks.push_back(cy * grid.chunksX + cx);
+                }
+            }
+        }
+
+        parallelFor((int)passChunks.size(), [&](int i) {
+            if (mixedWorld) {
+                updateChunk<true>(passChunks[i] % grid.chunksX, passChunks[i] / grid.chunksX, pass);
+            }
+            else {
+                updateChunk<false>(passChunks[i] % grid.chunksX, passChunks[i] / grid.chunksX, pass);
+            }
+        });
+
+        //hand queued wakes to their chunks. a wake for "now" only still counts if its chunk is
+        //stepped later in this tick, otherwise it waits for the next one
+        for (int index : passChunks) {
+            std::vector<PendingWake>& outbox = outboxes[index];
+            for (const PendingWake& wake : outbox) {
+                if (wake.y < 0 || wake.y >= grid.height) {
+                    continue;
+                }
+                int x0 = std::max(wake.x0, 0);
+                int x1 = std::min(wake.x1, grid.width - 1);
+                int cy = wake.y / CHUNK_SIZE;
+                for (int cx = x0 / CHUNK_SIZE; cx <= x1 / CHUNK_SIZE; ++cx) {
+                    bool now = wake.now && chunkPass(cx, cy) > pass;
+                    Chunk& chunk = chunkAt(cx, cy);
+                    expandRect(now ? chunk.current : chunk.next,
+                        std::max(x0, cx * CHUNK_SIZE), wake.y, std::min(x1, cx * CHUNK_SIZE + CHUNK_SIZE - 1), wake.y);
+                }
+            }
+            outbox.clear();
+        }
+        steppedChunks.insert(steppedChunks.end(), passChunks.begin(), passChunks.end());
+    }
+
+    for (int index : steppedChunks) {
+        clearMovedFlags(chunkFlagged[index]);
+    }
+}
+
+void updateSimulation() {
+    static SimEngine lastEngine = simEngine;
+
+    if (!isPaused) {
+        ++grid.tick;
+        mixedWorld = false;
+        for (int material = 0; material < MATERIAL_COUNT; ++material) {
+            if (material != SAND && MATERIALS[material].behaviour != BEHAVIOUR_STATIC && grid.materialCounts[material] > 0) {
+                mixedWorld = true;
+            }
+        }
+
+        //bitboard and active only know sand, margolus the first four materials. anything else in
+        //the world falls back to serial, and so does active on a world too big for its 32-bit indices
+        SimEngine engine = simEngine;
+        size_t cells = (size_t)grid.width * grid.height;
+        bool onlySand = grid.materialCounts[EMPTY] + grid.materialCounts[SAND] == cells;
+        bool blockMaterials = grid.materialCounts[EMPTY] + grid.materialCounts[SAND] + grid.materialCounts[WATER] + grid.materialCounts[STONE] == cells;
+        bool activeFits = cells <= UINT32_MAX;
+        if (((engine == ENGINE_BITBOARD || engine == ENGINE_ACTIVE) && !onlySand) || (engine == ENGINE_ACTIVE && !activeFits) ||
+            (engine == ENGINE_MARGOLUS && !blockMaterials)) {
+            engine = ENGINE_SERIAL;
+        }
+
+        //only serial and threaded keep dirty rects, so they start from scratch after the others
+        bool keepsRects = engine == ENGINE_SERIAL || engine == ENGINE_THREADED;
+        bool lastKeptRects = lastEngine == ENGINE_SERIAL || lastEngine == ENGINE_THREADED;
+        if (keepsRects && !lastKeptRects) {
+            wakeAll();
+        }
+        lastEngine = engine;
+        steppedEngine = engine;
+
+        if (engine != ENGINE_BITBOARD) {
+            grid.occupancyValid = false;
+        }
+        if (engine != ENGINE_ACTIVE) {
+            grid.activeValid = false;
+        }
+
+        if (engine == ENGINE_BITBOARD) {
+            updateBitboard();
+            return;
+        }
+        if (engine == ENGINE_ACTIVE) {
+            updateActive();
+            return;
+        }
+        if (engine == ENGINE_MARGOLUS) {
+            updateMargolus();
+            return;
+        }
+
+        //a full scan steps every chunk whole. each keeps to its own bounds, the rects are folded
+        //into what gets painted below
+        for (int cy = 0; cy < grid.chunksY; ++cy) {
+            for (int cx = 0; cx < grid.chunksX; ++cx) {
+                Chunk& chunk = chunkAt(cx, cy);
+                chunk.current = useDirtyChunks ? chunk.next : DirtyRect{
+                    cx * CHUNK_SIZE, cy * CHUNK_SIZE,
+                    std::min(cx * CHUNK_SIZE + CHUNK_SIZE, grid.width) - 1,
+                    std::min(cy * CHUNK_SIZE + CHUNK_SIZE, grid.height) - 1 };
+                chunk.next = EMPTY_RECT;
+            }
+        }
+
+        if (engine == ENGINE_THREADED) {
+            updateThreaded();
+        }
+        else {
+            updateSerial();
+        }
+
+        //a move starts on a cell in the rect being stepped and wakes the cell it lands on for the
+        //next tick, so the two rects cover every cell that changed
+        for (int i = 0; i < grid.chunksX * grid.chunksY; ++i) {
+            Chunk& chunk = grid.chunks[i];
+            for (const DirtyRect& rect : { chunk.current, chunk.next }) {
+                if (rect.minX <= rect.maxX) {
+                    expandRect(chunk.painted, rect.minX, rect.minY, rect.maxX, rect.maxY);
+                }
+            }
+        }
+    }
+}
+
+void takeCellWrites(std::vector<size_t>& writes) {
+    writes.clear();
+    writes.swap(cellWrites);
+}
+
+void takePaintedRects(std::vector<DirtyRect>& rects) {
+    rects.clear();
+    for (int cy = 0; cy < grid.chunksY; ++cy) {
+        DirtyRect run = EMPTY_RECT;
+        for (int cx = 0; cx < grid.chunksX; ++cx) {
+            DirtyRect& painted = chunkAt(cx, cy).painted;
+            if (painted.minX > painted.maxX) {
+                if (run.minX <= run.maxX) {
+                    rects.push_back(run);
+                    run = EMPTY_RECT;
+                }
+                continue;
+            }
+            expandRect(run, painted.minX, painted.minY, painted.maxX, painted.maxY);
+            painted = EMPTY_RECT;
+        }
+        if (run.minX <= run.maxX) {
+            rects.push_back(run);
+        }
+    }
+}
+
+int countParticles() {
+    int count = 0;
+    size_t cells = (size_t)grid.width * grid.height;
+    for (size_t i = 0; i < cells; ++i) {
+        if (grid.type[i] != EMPTY) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+int countAwakeChunks() {
+    int count = 0;
+    for (int i = 0; i < grid.chunksX * grid.chunksY; ++i) {
+        if (grid.chunks[i].next.minX <= grid.chunks[i].next.maxX) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+//fnv-1a over both planes, used by the headless runner to check two runs ended in the same state
+uint64_t gridHash() {
+    uint64_t hash = 1469598103934665603ull;
+    size_t cells = (size_t)grid.width * grid.height;
+    const unsigned char* planes[] = { (const unsigned char*)grid.type, (const unsigned char*)grid.color };
+    size_t sizes[] = { cells, cells * sizeof(uint32_t) };
+    for (int plane = 0; plane < 2; ++plane) {
+        for (size_t i = 0; i < sizes[plane]; ++i) {
+            hash ^= planes[plane][i];
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
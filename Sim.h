@@ -0,0 +1,192 @@
+#pragma once
+
+#include "Material.h"
+#include "Random.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+const int DEFAULT_GRID_WIDTH = 160;
+const int DEFAULT_GRID_HEIGHT = 160;
+const int DEFAULT_CELL_SIZE = 5;
+
+const int CHUNK_SIZE = 32;
+
+// the widest and tallest world the session logs, world files and instanced drawing take, so a
+// cell's coordinates fit in 16 bits. resizeGrid itself takes anything that fits in memory
+const int MAX_GRID_SIDE = 65536;
+
+// ticks a grain that can't move stays on the active engine's list before it drops out
+const int ACTIVE_SLEEP_TICKS = 4;
+
+// inclusive box of cells (grid coordinates) that may be able to move, empty when minX > maxX
+struct DirtyRect {
+    int minX, minY, maxX, maxY;
+};
+
+const DirtyRect EMPTY_RECT = { INT_MAX, INT_MAX, -1, -1 };
+
+inline void expandRect(DirtyRect& rect, int x0, int y0, int x1, int y1) {
+    rect.minX = std::min(rect.minX, x0);
+    rect.minY = std::min(rect.minY, y0);
+    rect.maxX = std::max(rect.maxX, x1);
+    rect.maxY = std::max(rect.maxY, y1);
+}
+
+// current is being stepped this tick, next collects everything woken for the following tick.
+// painted covers the cells whose color changed since the renderer last took them
+struct Chunk {
+    DirtyRect current;
+    DirtyRect next;
+    DirtyRect painted;
+};
+
+// structure of arrays, 5 bytes per cell. the update loop only has to scan the dense type plane,
+// colors are packed rgba8 (r in the lowest byte) and are only touched when something moves.
+// planes are row-major with y = 0 at the bottom, sized by resizeGrid
+struct Grid {
+    int width = 0, height = 0;
+    int chunksX = 0, chunksY = 0;
+    int occupancyWords = 0;
+
+    uint8_t* type = nullptr;
+    uint32_t* color = nullptr;
+    Chunk* chunks = nullptr;
+
+    // one bit per cell (bit i of word k is column 64k + i), only kept in sync while the bitboard
+    // engine is running. setCell keeps it up to date while valid, other engines clear the flag
+    uint64_t* occupancy = nullptr;
+    bool occupancyValid = false;
+
+    // one byte per cell saying whether it is on the active engine's list, same rules as occupancy
+    uint8_t* activeState = nullptr;
+    bool activeValid = false;
+
+    // cells of each material, kept by setCell (moves only swap cells around)
+    size_t materialCounts[MATERIAL_COUNT] = {};
+
+    // ticks stepped since initializeGrid, counting the one being stepped. rules that alternate
+    // every tick go by its parity, so a world replays the same from the same start
+    unsigned tick = 0;
+
+    // the brush's draws (scatter directions, sparse fills), restarted by initializeGrid under the
+    // current seed so the same strokes land the same way again
+    RandomStream brushRandom;
+};
+
+// serial sweeps the rows bottom-up on the calling thread and matches a plain full scan exactly.
+// threaded steps the chunks in four checkerboard passes on the worker pool, grains crossing
+// chunk borders can resolve in a slightly different order.
+// bitboard runs the same row sweep as serial on the occupancy bits, 64 cells per step.
+// active runs the serial sweep over a sorted list of the grains that can still move.
+// margolus steps independent 2x2 blocks through a lookup table, on an offset that flips every tick.
+// bitboard and active only know sand and margolus only the first four materials, a world with
+// anything else in it runs serial instead. so does active on a world of more than 4G cells
+enum SimEngine {
+    ENGINE_SERIAL,
+    ENGINE_THREADED,
+    ENGINE_BITBOARD,
+    ENGINE_ACTIVE,
+    ENGINE_MARGOLUS,
+    ENGINE_COUNT
+};
+
+const char* const ENGINE_NAMES[ENGINE_COUNT] = { "serial", "threaded", "bitboard", "active", "margolus" };
+
+extern Grid grid;
+extern int cellSize;
+extern glm::vec4 currentColor;
+extern CellType currentMaterial;
+extern bool isPaused;
+extern bool useDirtyChunks;
+extern SimEngine simEngine;
+// the engine the last tick actually ran on: simEngine, or serial where simEngine doesn't know
+// every material in the world (or active on a world too big for it)
+extern SimEngine steppedEngine;
+// while set, setCell keeps the index of every cell it writes for takeCellWrites. for backends
+// that keep the world somewhere else (the gpu) and copy the brush's cells over from the grid
+extern bool recordCellWrites;
+
+inline size_t cellIndex(int x, int y) {
+    return (size_t)y * grid.width + x;
+}
+
+inline uint8_t* typeRow(int y) {
+    return grid.type + (size_t)y * grid.width;
+}
+
+inline uint32_t* colorRow(int y) {
+    return grid.color + (size_t)y * grid.width;
+}
+
+inline uint64_t* occupancyRow(int y) {
+    return grid.occupancy + (size_t)y * grid.occupancyWords;
+}
+
+inline Chunk& chunkAt(int cx, int cy) {
+    return grid.chunks[(size_t)cy * grid.chunksX + cx];
+}
+
+// marks an inclusive box of cells for the renderer to upload again. not thread safe, engines
+// that step in parallel mark what they touched once the jobs are done
+inline void paintCells(int x0, int y0, int x1, int y1) {
+    for (int cy = y0 / CHUNK_SIZE; cy <= y1 / CHUNK_SIZE; ++cy) {
+        for (int cx = x0 / CHUNK_SIZE; cx <= x1 / CHUNK_SIZE; ++cx) {
+            expandRect(chunkAt(cx, cy).painted,
+                std::max(x0, cx * CHUNK_SIZE), std::max(y0, cy * CHUNK_SIZE),
+                std::min(x1, cx * CHUNK_SIZE + CHUNK_SIZE - 1), std::min(y1, cy * CHUNK_SIZE + CHUNK_SIZE - 1));
+        }
+    }
+}
+
+uint32_t packColor(const glm::vec4& color);
+glm::vec4 unpackColor(uint32_t color);
+// color a new cell of this material gets, sand follows the brush color
+uint32_t materialColor(CellType material, const glm::vec4& brush);
+
+// reallocates every plane for a width x height world and clears it. big worlds are backed by
+// huge pages where the os allows it
+void resizeGrid(int width, int height);
+void initializeGrid();
+void setCell(int x, int y, CellType type, uint32_t color);
+// setCell over the cells x0..x1 of row y (clipped to the grid), the planes written in one pass
+void fillSpan(int x0, int x1, int y, CellType type, uint32_t color);
+void wakeCell(int x, int y);
+void wakeAll();
+// the brush at a window position (world pixels, y down) with the current material and color
+void placeSand(int mouseX, int mouseY);
+void randomPlaceSand(int mouseX, int mouseY);
+// the same on a grid cell: place paints the cell itself, the same as a click with the smallest
+// brush, scatter drops one a little above it going up, up-left or up-right, drawn from
+// grid.brushRandom
+void placeCell(int gridX, int gridY, CellType material, uint32_t color);
+void scatterCell(int gridX, int gridY, CellType material, uint32_t color);
+void updateSimulation();
+// hands out the painted boxes and clears them, painted chunks next to each other on a chunk row
+// are merged into one box
+void takePaintedRects(std::vector<DirtyRect>& rects);
+// hands out the cells written since the last call, in the order they were written
+void takeCellWrites(std::vector<size_t>& writes);
+
+void rebuildOccupancy();
+void updateBitboard();
+
+void listActiveCell(int x, int y);
+void wakeActiveAbove(int x, int y);
+void rebuildActiveList();
+void updateActive();
+int countActiveCells();
+
+void updateMargolus();
+// the 256-entry block table, indexed by the state byte (four 2-bit materials, top left first).
+// each entry holds four 2-bit source cells, where each cell of the next state comes from
+const uint8_t* margolusRules();
+
+int countParticles();
+int countAwakeChunks();
+uint64_t gridHash();
@@ -0,0 +1,177 @@
+#include "SimThread.h"
+#include "Brush.h"
+#include "Profiler.h"
+#include "Replay.h"
+
+#include <algorithm>
+#include <thread>
+
+std::mutex gridMutex;
+std::atomic<int> tickRate(60);
+std::atomic<int> maxSubsteps(8);
+
+int FixedTimestep::advance(int rate, int maxTicks, bool paused) {
+    using namespace std::chrono;
+    auto now = steady_clock::now();
+    accumulator += duration<double>(now - last).count();
+    last = now;
+
+    double tickLength = 1.0 / rate;
+    if (paused) {
+        accumulator = 0.0;
+    }
+    int due = 0;
+    while (accumulator >= tickLength && due < maxTicks) {
+        accumulator -= tickLength;
+        ++due;
+    }
+    if (due == maxTicks) {
+        accumulator = std::min(accumulator, tickLength);
+    }
+
+    counted += due;
+    double countedTime = duration<double>(now - countStart).count();
+    if (countedTime >= 0.5) {
+        measuredRate = (float)(counted / countedTime);
+        counted = 0;
+        countStart = now;
+    }
+    return due;
+}
+
+double FixedTimestep::untilNextTick(int rate) const {
+    return std::max(1.0 / rate - accumulator, 0.0);
+}
+
+//the three slots. the writer owns back, the reader owns front, middle is handed over with an
+//atomic exchange. FRESH on middle means the writer put a snapshot there the reader hasn't taken
+static Snapshot slots[3];
+static const int FRESH = 4;
+static int backSlot = 0;
+static std::atomic<int> middleSlot(1);
+static int frontSlot = 2;
+
+//writer side: what changed since each slot was last written, and what the reader hasn't been
+//handed yet
+static std::vector<DirtyRect> staleRects[3];
+static std::vector<DirtyRect> undelivered;
+static std::vector<DirtyRect> newRects;
+
+static std::thread simThread;
+static std::atomic<bool> running(false);
+
+//past this many boxes a list is replaced by one box over the whole world
+const size_t MAX_RECTS = 4096;
+
+static void addRects(std::vector<DirtyRect>& to, const std::vector<DirtyRect>& from) {
+    if (to.size() + from.size() > MAX_RECTS) {
+        to.assign(1, { 0, 0, grid.width - 1, grid.height - 1 });
+        return;
+    }
+    to.insert(to.end(), from.begin(), from.end());
+}
+
+static void copyRect(Snapshot& slot, const DirtyRect& rect) {
+    for (int y = rect.minY; y <= rect.maxY; ++y) {
+        const uint32_t* colors = colorRow(y);
+        std::copy(colors + rect.minX, colors + rect.maxX + 1, slot.color.data() + cellIndex(rect.minX, y));
+    }
+}
+
+static uint64_t published = 0;
+
+//runs on the sim thread with gridMutex held. nothing is published if nothing changed
+static void publish(bool ticked, uint64_t tick, float ticksPerSecond) {
+    takePaintedRects(newRects);
+    Snapshot& back = slots[backSlot];
+    bool resized = back.width != grid.width || back.height != grid.height;
+    if (!ticked && !resized && newRects.empty()) {
+        return;
+    }
+
+    for (int slot = 0; slot < 3; ++slot) {
+        if (slot != backSlot) {
+            addRects(staleRects[slot], newRects);
+        }
+    }
+
+    if (resized) {
+        back.width = grid.width;
+        back.height = grid.height;
+        back.color.assign(grid.color, grid.color + (size_t)grid.width * grid.height);
+    }
+    else {
+        for (const DirtyRect& rect : staleRects[backSlot]) {
+            copyRect(back, rect);
+        }
+        for (const DirtyRect& rect : newRects) {
+            copyRect(back, rect);
+        }
+    }
+    staleRects[backSlot].clear();
+
+    back.painted = undelivered;
+    addRects(back.painted, newRects);
+    back.filled = (size_t)grid.width * grid.height - grid.materialCounts[EMPTY];
+    back.sequence = ++published;
+    back.tick = tick;
+    back.ticksPerSecond = ticksPerSecond;
+    back.awakeChunks = countAwakeChunks();
+    back.activeParticles = countActiveCells();
+
+    int previous = middleSlot.exchange(backSlot | FRESH);
+    //a snapshot the reader never took is gone, what it was carrying goes with the next one
+    if (previous & FRESH) {
+        undelivered = back.painted;
+    }
+    else {
+        undelivered = newRects;
+    }
+    backSlot = previous & ~FRESH;
+}
+
+static void simLoop() {
+    FixedTimestep timestep;
+    uint64_t tick = 0;
+    while (running) {
+        int rate;
+        {
+            std::lock_guard<std::mutex> lock(gridMutex);
+            rate = tickRate;
+            int due = timestep.advance(rate, maxSubsteps, isPaused);
+            //strokes land while paused or between ticks too
+            if (due == 0) {
+                drainBrushCommands();
+            }
+            for (int i = 0; i < due; ++i) {
+                ProfileScope timing(STAGE_SIMULATION);
+                drainBrushCommands();
+                updateSimulation();
+                recordTick();
+                ++tick;
+            }
+            publish(due > 0, tick, timestep.measuredRate);
+        }
+        double wait = std::min(timestep.untilNextTick(rate), 0.002);
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+    }
+}
+
+void startSimThread() {
+    running = true;
+    simThread = std::thread(simLoop);
+}
+
+void stopSimThread() {
+    running = false;
+    if (simThread.joinable()) {
+        simThread.join();
+    }
+}
+
+const Snapshot& latestSnapshot() {
+    if (middleSlot.load() & FRESH) {
+        frontSlot = middleSlot.exchange(frontSlot) & ~FRESH;
+    }
+    return slots[frontSlot];
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Sim.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// runs ticks at a fixed rate: advance adds the time since the last call and says how many ticks
+// have come due, at most maxTicks, so a slow caller drops time instead of piling it up
+struct FixedTimestep {
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    double accumulator = 0.0;
+    // ticks/s over the last half second or so
+    float measuredRate = 0.0f;
+    std::chrono::steady_clock::time_point countStart = last;
+    int counted = 0;
+
+    int advance(int rate, int maxTicks, bool paused);
+    // seconds until the next tick is due
+    double untilNextTick(int rate) const;
+};
+
+// one finished frame of the world, everything the renderer and the ui read
+struct Snapshot {
+    int width = 0, height = 0;
+    std::vector<uint32_t> color;        // like grid.color, 0 where the cell is empty
+    // cells that changed since the last snapshot the reader took (more is fine, never less)
+    std::vector<DirtyRect> painted;
+    size_t filled = 0;                  // cells that aren't empty
+    uint64_t sequence = 0;              // counts up by one with every snapshot published
+    uint64_t tick = 0;
+    float ticksPerSecond = 0.0f;
+    int awakeChunks = 0;
+    int activeParticles = 0;
+};
+
+// the simulation on its own thread. it steps at tickRate, and after every batch of ticks copies
+// whatever changed into the back one of three snapshots and swaps it into the middle slot. the
+// render thread swaps the middle slot for its own whenever there is a newer one, so neither side
+// ever waits for the other: a slow frame doesn't hold up the ticks, a slow tick doesn't hold up
+// the frames, the renderer just draws the last finished one again.
+//
+// the brush goes through its own queue (Brush.h). anything else that touches the grid or the sim
+// settings (resize, reset, pausing, switching engines) has to hold gridMutex, the sim thread
+// holds it while it ticks
+extern std::mutex gridMutex;
+extern std::atomic<int> tickRate;
+extern std::atomic<int> maxSubsteps;
+
+void startSimThread();
+void stopSimThread();
+// the newest finished snapshot. it belongs to the caller until the next call, which hands it
+// back to the sim thread
+const Snapshot& latestSnapshot();
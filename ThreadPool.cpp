@@ -0,0 +1,117 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static std::vector<std::thread> workers;
+static std::mutex poolMutex;
+static std::condition_variable workReady;
+static std::condition_variable workDone;
+
+static const std::function<void(int)>* currentJob = nullptr;
+static int jobCount = 0;
+static std::atomic<int> nextJob(0);
+static int busyWorkers = 0;
+static unsigned generation = 0;
+static bool stopping = false;
+static bool started = false;
+
+static void runJobs(const std::function<void(int)>& job, int count) {
+    for (int i = nextJob.fetch_add(1); i < count; i = nextJob.fetch_add(1)) {
+        job(i);
+    }
+}
+
+//seen is the generation the worker was started at, so it only wakes for jobs handed out after
+static void workerLoop(unsigned seen) {
+    for (;;) {
+        const std::function<void(int)>* job;
+        int count;
+        {
+            std::unique_lock<std::mutex> lock(poolMutex);
+            workReady.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            job = currentJob;
+            count = jobCount;
+        }
+
+        runJobs(*job, count);
+
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (--busyWorkers == 0) {
+            workDone.notify_one();
+        }
+    }
+}
+
+static void stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        stopping = true;
+    }
+    workReady.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    stopping = false;
+}
+
+//joins the workers when the program exits
+static struct PoolShutdown {
+    ~PoolShutdown() { stopWorkers(); }
+} poolShutdown;
+
+void setWorkerCount(int count) {
+    stopWorkers();
+    started = true;
+    unsigned seen;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        seen = generation;
+    }
+    for (int i = 1; i < count; ++i) {
+        workers.emplace_back(workerLoop, seen);
+    }
+}
+
+int workerCount() {
+    if (!started) {
+        setWorkerCount((int)std::max(1u, std::thread::hardware_concurrency()));
+    }
+    return (int)workers.size() + 1;
+}
+
+void parallelFor(int count, const std::function<void(int)>& job) {
+    if (workerCount() == 1 || count <= 1) {
+        for (int i = 0; i < count; ++i) {
+            job(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        currentJob = &job;
+        jobCount = count;
+        nextJob = 0;
+        busyWorkers = (int)workers.size();
+        ++generation;
+    }
+    workReady.notify_all();
+
+    runJobs(job, count);
+
+    std::unique_lock<std::mutex> lock(poolMutex);
+    workDone.wait(lock, [] { return busyWorkers == 0; });
+    //the job goes out of scope with the caller
+    currentJob = nullptr;
+    jobCount = 0;
+}
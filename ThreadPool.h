@@ -0,0 +1,12 @@
+#pragma once
+
+#include <functional>
+
+// a fixed set of worker threads that sleep until parallelFor hands them work.
+// started lazily with one worker per hardware thread (the caller counts as one)
+
+void setWorkerCount(int count);
+int workerCount();
+
+// runs job(0) .. job(count - 1) on the workers and the calling thread, returns once all are done
+void parallelFor(int count, const std::function<void(int)>& job);
@@ -0,0 +1,559 @@
+#include "WorldFile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char WORLD_MAGIC[7] = { 'S', 'A', 'N', 'D', 'W', 'L', 'D' };
+static const size_t WORLD_HEADER_SIZE = 68;
+static const size_t TABLE_ENTRY_SIZE = 20;
+
+static void putFixed(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.push_back((uint8_t)(value >> (8 * i)));
+    }
+}
+
+static uint64_t readFixed(const uint8_t* at, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= (uint64_t)at[i] << (8 * i);
+    }
+    return value;
+}
+
+struct ChunkReader {
+    const uint8_t* at;
+    const uint8_t* end;
+    bool ok;
+};
+
+static uint64_t getVarint(ChunkReader& in) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in.at == in.end) {
+            break;
+        }
+        uint8_t byte = *in.at++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    in.ok = false;
+    return 0;
+}
+
+//a word at a time, it only has to catch a damaged or cut off file
+static uint64_t checksum(const uint8_t* bytes, size_t size) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    //an empty chunk has no bytes to point at
+    uint64_t tail = 0;
+    if (i < size) {
+        std::memcpy(&tail, bytes + i, size - i);
+    }
+    hash = (hash ^ tail) * 0xff51afd7ed558ccdull;
+    return hash ^ (hash >> 29);
+}
+
+struct CellRun {
+    uint8_t type;
+    uint32_t color;
+    uint32_t length;
+    uint32_t index;
+};
+
+enum ChunkEncoding {
+    CHUNK_PALETTE,
+    CHUNK_RAW_COLORS
+};
+
+//colors to palette indices for one chunk at a time, open addressed and at most half full. a slot
+//only counts if it was filled for the current chunk, so nothing is cleared between chunks
+const int PALETTE_BITS = 11;
+static_assert((1 << PALETTE_BITS) >= 2 * CHUNK_SIZE * CHUNK_SIZE, "palette table too small for a chunk");
+
+struct PaletteTable {
+    uint32_t colors[1 << PALETTE_BITS];
+    uint32_t index[1 << PALETTE_BITS];
+    uint32_t filledFor[1 << PALETTE_BITS];
+    uint32_t chunk;
+};
+
+static size_t varintSize(uint64_t value) {
+    size_t bytes = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++bytes;
+    }
+    return bytes;
+}
+
+static uint8_t* writeVarint(uint8_t* at, uint64_t value) {
+    while (value >= 0x80) {
+        *at++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *at++ = (uint8_t)value;
+    return at;
+}
+
+static uint8_t* writeFixed(uint8_t* at, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        *at++ = (uint8_t)(value >> (8 * i));
+    }
+    return at;
+}
+
+const int CHUNK_CELLS = CHUNK_SIZE * CHUNK_SIZE;
+
+//nothing for a chunk of empty cells that were never painted. otherwise the runs with a palette,
+//or, when nearly every cell has a color of its own, the material runs and the colors as they are.
+//everything goes through per thread buffers big enough for the worst case, the chunk's bytes are
+//copied out once at the end
+static void encodeChunk(int cx, int cy, std::vector<uint8_t>& out) {
+    thread_local CellRun runs[CHUNK_CELLS];
+    thread_local uint32_t palette[CHUNK_CELLS];
+    thread_local uint8_t bytes[1 + 8 * CHUNK_CELLS];
+    thread_local PaletteTable table;
+    int x0 = cx * CHUNK_SIZE, y0 = cy * CHUNK_SIZE;
+    int x1 = std::min(x0 + CHUNK_SIZE, grid.width), y1 = std::min(y0 + CHUNK_SIZE, grid.height);
+    size_t cells = (size_t)(x1 - x0) * (y1 - y0);
+
+    int runCount = 0;
+    for (int y = y0; y < y1; ++y) {
+        const uint8_t* types = grid.type + cellIndex(0, y);
+        const uint32_t* colors = grid.color + cellIndex(0, y);
+        for (int x = x0; x < x1; ++x) {
+            if (runCount > 0 && runs[runCount - 1].type == types[x] && runs[runCount - 1].color == colors[x]) {
+                ++runs[runCount - 1].length;
+            }
+            else {
+                runs[runCount++] = { types[x], colors[x], 1, 0 };
+            }
+        }
+    }
+    if (runCount == 1 && runs[0].type == EMPTY && runs[0].color == 0) {
+        return;
+    }
+
+    uint32_t paletteSize = 0;
+    size_t runBytes = 0;
+    ++table.chunk;
+    for (int i = 0; i < runCount; ++i) {
+        CellRun& run = runs[i];
+        uint32_t slot = (run.color * 0x9E3779B1u) >> (32 - PALETTE_BITS);
+        while (table.filledFor[slot] == table.chunk && table.colors[slot] != run.color) {
+            slot = (slot + 1) & ((1 << PALETTE_BITS) - 1);
+        }
+        if (table.filledFor[slot] != table.chunk) {
+            table.filledFor[slot] = table.chunk;
+            table.colors[slot] = run.color;
+            table.index[slot] = paletteSize;
+            palette[paletteSize++] = run.color;
+        }
+        run.index = table.index[slot];
+        runBytes += 1 + varintSize(run.length) + varintSize(run.index);
+    }
+
+    uint8_t* at = bytes;
+    if (1 + varintSize(paletteSize) + 4 * (size_t)paletteSize + runBytes <= cells * sizeof(uint32_t)) {
+        *at++ = CHUNK_PALETTE;
+        at = writeVarint(at, paletteSize);
+        for (uint32_t i = 0; i < paletteSize; ++i) {
+            at = writeFixed(at, palette[i], 4);
+        }
+        for (int i = 0; i < runCount; ++i) {
+            *at++ = runs[i].type;
+            at = writeVarint(at, runs[i].length);
+            at = writeVarint(at, runs[i].index);
+        }
+    }
+    else {
+        *at++ = CHUNK_RAW_COLORS;
+        for (int i = 0; i < runCount;) {
+            uint8_t type = runs[i].type;
+            uint32_t length = 0;
+            for (; i < runCount && runs[i].type == type; ++i) {
+                length += runs[i].length;
+            }
+            *at++ = type;
+            at = writeVarint(at, length);
+        }
+        for (int y = y0; y < y1; ++y) {
+            std::memcpy(at, grid.color + cellIndex(x0, y), (x1 - x0) * sizeof(uint32_t));
+            at += (x1 - x0) * sizeof(uint32_t);
+        }
+    }
+    out.assign(bytes, at);
+}
+
+bool saveWorld(const char* path) {
+    if (grid.width > MAX_GRID_SIDE || grid.height > MAX_GRID_SIDE) {
+        std::cerr << "a " << grid.width << "x" << grid.height << " world is too big to save, world files take up to "
+            << MAX_GRID_SIDE << " cells a side" << std::endl;
+        return false;
+    }
+    int chunks = grid.chunksX * grid.chunksY;
+    std::vector<std::vector<uint8_t>> encoded(chunks);
+    parallelFor(chunks, [&](int chunk) {
+        encodeChunk(chunk % grid.chunksX, chunk / grid.chunksX, encoded[chunk]);
+    });
+
+    std::vector<uint8_t> head;
+    for (char letter : WORLD_MAGIC) {
+        head.push_back((uint8_t)letter);
+    }
+    head.push_back(WORLD_FILE_VERSION);
+    putFixed(head, (uint32_t)grid.width, 4);
+    putFixed(head, (uint32_t)grid.height, 4);
+    putFixed(head, (uint32_t)CHUNK_SIZE, 4);
+    putFixed(head, grid.tick, 4);
+    const RandomStream& random = grid.brushRandom;
+    putFixed(head, random.key[0], 4);
+    putFixed(head, random.key[1], 4);
+    putFixed(head, random.stream, 8);
+    putFixed(head, random.block, 8);
+    for (uint32_t number : random.buffer) {
+        putFixed(head, number, 4);
+    }
+    putFixed(head, (uint32_t)random.used, 4);
+
+    uint64_t offset = WORLD_HEADER_SIZE + (uint64_t)chunks * TABLE_ENTRY_SIZE + 8;
+    for (const std::vector<uint8_t>& chunk : encoded) {
+        putFixed(head, offset, 8);
+        putFixed(head, chunk.size(), 4);
+        putFixed(head, checksum(chunk.data(), chunk.size()), 8);
+        offset += chunk.size();
+    }
+    putFixed(head, checksum(head.data(), head.size()), 8);
+
+    std::FILE* file = std::fopen(path, "wb");
+    if (!file) {
+        std::cerr << "could not open " << path << " to save the world to" << std::endl;
+        return false;
+    }
+    bool ok = std::fwrite(head.data(), 1, head.size(), file) == head.size();
+    for (const std::vector<uint8_t>& chunk : encoded) {
+        ok = ok && std::fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+    }
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok) {
+        std::cerr << "could not write " << path << std::endl;
+    }
+    return ok;
+}
+
+static bool mapFile(const char* path, WorldFile& file) {
+#if defined(_WIN32)
+    HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mappingHandle = nullptr;
+    const void* view = nullptr;
+    if (GetFileSizeEx(fileHandle, &size) && size.QuadPart > 0) {
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    if (mappingHandle) {
+        view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!view) {
+        if (mappingHandle) {
+            CloseHandle(mappingHandle);
+        }
+        CloseHandle(fileHandle);
+        return false;
+    }
+    file.data = (const uint8_t*)view;
+    file.size = (size_t)size.QuadPart;
+    file.fileHandle = fileHandle;
+    file.mappingHandle = mappingHandle;
+    return true;
+#else
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return false;
+    }
+    struct stat status;
+    void* view = MAP_FAILED;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+        view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    }
+    //the mapping keeps the file
+    close(descriptor);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    file.data = (const uint8_t*)view;
+    file.size = (size_t)status.st_size;
+    return true;
+#endif
+}
+
+void closeWorldFile(WorldFile& file) {
+    if (!file.data) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(file.data);
+    CloseHandle((HANDLE)file.mappingHandle);
+    CloseHandle((HANDLE)file.fileHandle);
+    file.fileHandle = nullptr;
+    file.mappingHandle = nullptr;
+#else
+    munmap((void*)file.data, file.size);
+#endif
+    file.data = nullptr;
+    file.size = 0;
+}
+
+static const uint8_t* tableEntry(const WorldFile& file, int chunk) {
+    return file.data + WORLD_HEADER_SIZE + (size_t)chunk * TABLE_ENTRY_SIZE;
+}
+
+bool openWorldFile(const char* path, WorldFile& file) {
+    if (!mapFile(path, file)) {
+        std::cerr << "could not open world file " << path << std::endl;
+        return false;
+    }
+    const uint8_t* head = file.data;
+    if (file.size < WORLD_HEADER_SIZE + 8 || std::memcmp(head, WORLD_MAGIC, sizeof(WORLD_MAGIC)) != 0) {
+        std::cerr << path << " is not a world file" << std::endl;
+        closeWorldFile(file);
+        return false;
+    }
+    if (head[7] != WORLD_FILE_VERSION) {
+        std::cerr << path << " is a version " << (int)head[7] << " world file, this build reads version " << (int)WORLD_FILE_VERSION << std::endl;
+        closeWorldFile(file);
+        return false;
+    }
+    uint64_t width = readFixed(head + 8, 4), height = readFixed(head + 12, 4), chunkSize = readFixed(head + 16, 4);
+    bool valid = width > 0 && height > 0 && width <= MAX_GRID_SIDE && height <= MAX_GRID_SIDE && chunkSize > 0 && chunkSize <= 4096;
+    if (valid) {
+        file.width = (int)width;
+        file.height = (int)height;
+        file.chunkSize = (int)chunkSize;
+        file.chunksX = (file.width + file.chunkSize - 1) / file.chunkSize;
+        file.chunksY = (file.height + file.chunkSize - 1) / file.chunkSize;
+        size_t tableEnd = WORLD_HEADER_SIZE + (size_t)file.chunksX * file.chunksY * TABLE_ENTRY_SIZE;
+        valid = tableEnd + 8 <= file.size && readFixed(file.data + tableEnd, 8) == checksum(file.data, tableEnd);
+        for (int chunk = 0; valid && chunk < file.chunksX * file.chunksY; ++chunk) {
+            uint64_t offset = readFixed(tableEntry(file, chunk), 8), size = readFixed(tableEntry(file, chunk) + 8, 4);
+            valid = offset >= tableEnd + 8 && offset <= file.size && size <= file.size - offset;
+        }
+    }
+    if (!valid) {
+        std::cerr << path << " is damaged" << std::endl;
+        closeWorldFile(file);
+        return false;
+    }
+
+    file.tick = (unsigned)readFixed(head + 20, 4);
+    RandomStream& random = file.brushRandom;
+    random.key[0] = (uint32_t)readFixed(head + 24, 4);
+    random.key[1] = (uint32_t)readFixed(head + 28, 4);
+    random.stream = readFixed(head + 32, 8);
+    random.block = readFixed(head + 40, 8);
+    for (int i = 0; i < 4; ++i) {
+        random.buffer[i] = (uint32_t)readFixed(head + 48 + 4 * i, 4);
+    }
+    random.used = (int)std::min<uint64_t>(readFixed(head + 64, 4), 4);
+    return true;
+}
+
+bool checkWorldChunk(const WorldFile& file, int chunk) {
+    const uint8_t* entry = tableEntry(file, chunk);
+    size_t offset = (size_t)readFixed(entry, 8), size = (size_t)readFixed(entry + 8, 4);
+    return checksum(file.data + offset, size) == readFixed(entry + 12, 8);
+}
+
+bool decodeWorldChunk(const WorldFile& file, int chunk, uint8_t* typePlane, uint32_t* colorPlane, size_t counts[MATERIAL_COUNT]) {
+    const uint8_t* entry = tableEntry(file, chunk);
+    size_t offset = (size_t)readFixed(entry, 8), size = (size_t)readFixed(entry + 8, 4);
+    int x0 = chunk % file.chunksX * file.chunkSize, y0 = chunk / file.chunksX * file.chunkSize;
+    int width = std::min(file.chunkSize, file.width - x0), height = std::min(file.chunkSize, file.height - y0);
+    int cells = width * height;
+    size_t corner = (size_t)y0 * file.width + x0;
+
+    if (size == 0) {
+        for (int y = 0; y < height; ++y) {
+            std::memset(typePlane + corner + (size_t)y * file.width, EMPTY, width);
+            std::memset(colorPlane + corner + (size_t)y * file.width, 0, width * sizeof(uint32_t));
+        }
+        counts[EMPTY] += cells;
+        return true;
+    }
+
+    ChunkReader in = { file.data + offset, file.data + offset + size, true };
+    uint8_t encoding = *in.at++;
+    //runs carry on across the chunk's rows, x is where the next one starts in the current row
+    uint8_t* types = typePlane + corner;
+    uint32_t* colors = colorPlane + corner;
+    int x = 0;
+    uint64_t left = cells;
+    if (encoding == CHUNK_RAW_COLORS) {
+        //the material runs, then every color as it was
+        while (left > 0) {
+            if (in.at == in.end) {
+                return false;
+            }
+            uint8_t type = *in.at++;
+            uint64_t length = getVarint(in);
+            if (!in.ok || type >= MATERIAL_COUNT || length == 0 || length > left) {
+                return false;
+            }
+            counts[type] += length;
+            left -= length;
+            while (length > 0) {
+                int span = (int)std::min<uint64_t>(length, width - x);
+                std::memset(types + x, type, span);
+                x += span;
+                length -= span;
+                if (x == width) {
+                    x = 0;
+                    types += file.width;
+                }
+            }
+        }
+        if ((size_t)(in.end - in.at) != (size_t)cells * sizeof(uint32_t)) {
+            return false;
+        }
+        //empty cells have no color (setCell's rule, the renderer counts on it), whatever the file says
+        types = typePlane + corner;
+        for (int y = 0; y < height; ++y) {
+            std::memcpy(colors, in.at, width * sizeof(uint32_t));
+            in.at += width * sizeof(uint32_t);
+            for (int i = 0; i < width; ++i) {
+                if (types[i] == EMPTY) {
+                    colors[i] = 0;
+                }
+            }
+            types += file.width;
+            colors += file.width;
+        }
+        return true;
+    }
+    if (encoding != CHUNK_PALETTE) {
+        return false;
+    }
+
+    uint64_t paletteSize = getVarint(in);
+    if (!in.ok || paletteSize == 0 || paletteSize > (uint64_t)cells || (size_t)(in.end - in.at) < paletteSize * 4) {
+        return false;
+    }
+    const uint8_t* palette = in.at;
+    in.at += paletteSize * 4;
+
+    while (left > 0) {
+        if (in.at == in.end) {
+            return false;
+        }
+        uint8_t type = *in.at++;
+        uint64_t length = getVarint(in);
+        uint64_t index = getVarint(in);
+        if (!in.ok || type >= MATERIAL_COUNT || length == 0 || length > left || index >= paletteSize) {
+            return false;
+        }
+        uint32_t color = type == EMPTY ? 0 : (uint32_t)readFixed(palette + index * 4, 4);
+        counts[type] += length;
+        left -= length;
+        while (length > 0) {
+            int span = (int)std::min<uint64_t>(length, width - x);
+            std::memset(types + x, type, span);
+            std::fill(colors + x, colors + x + span, color);
+            x += span;
+            length -= span;
+            if (x == width) {
+                x = 0;
+                types += file.width;
+                colors += file.width;
+            }
+        }
+    }
+    return in.at == in.end;
+}
+
+bool loadWorld(const char* path) {
+    WorldFile file;
+    if (!openWorldFile(path, file)) {
+        return false;
+    }
+    int chunks = file.chunksX * file.chunksY;
+    std::atomic<bool> intact(true);
+    parallelFor(chunks, [&](int chunk) {
+        if (!checkWorldChunk(file, chunk)) {
+            intact = false;
+        }
+    });
+    if (!intact) {
+        std::cerr << path << " is damaged" << std::endl;
+        closeWorldFile(file);
+        return false;
+    }
+
+    //decoded off to the side, a chunk whose runs don't add up is only found out here
+    size_t cells = (size_t)file.width * file.height;
+    std::vector<uint8_t> types(cells);
+    std::vector<uint32_t> colors(cells);
+    std::vector<std::array<size_t, MATERIAL_COUNT>> counts(chunks);
+    std::atomic<bool> decoded(true);
+    parallelFor(chunks, [&](int chunk) {
+        counts[chunk].fill(0);
+        if (!decodeWorldChunk(file, chunk, types.data(), colors.data(), counts[chunk].data())) {
+            decoded = false;
+        }
+    });
+    closeWorldFile(file);
+    if (!decoded) {
+        std::cerr << path << " has chunks that don't decode" << std::endl;
+        return false;
+    }
+
+    if (grid.width != file.width || grid.height != file.height) {
+        resizeGrid(file.width, file.height);
+    }
+    else {
+        initializeGrid();
+    }
+    std::memcpy(grid.type, types.data(), cells);
+    std::memcpy(grid.color, colors.data(), cells * sizeof(uint32_t));
+
+    std::fill(grid.materialCounts, grid.materialCounts + MATERIAL_COUNT, 0);
+    for (const std::array<size_t, MATERIAL_COUNT>& chunkCounts : counts) {
+        for (int material = 0; material < MATERIAL_COUNT; ++material) {
+            grid.materialCounts[material] += chunkCounts[material];
+        }
+    }
+    grid.tick = file.tick;
+    grid.brushRandom = file.brushRandom;
+    //every engine's bookkeeping starts over, as after downloadGpuWorld
+    grid.occupancyValid = false;
+    grid.activeValid = false;
+    wakeAll();
+    paintCells(0, 0, grid.width - 1, grid.height - 1);
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Sim.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// world files: the whole grid saved to disk and back, including the tick count and the brush's
+// random stream, so a loaded world steps on exactly as the saved one would have.
+//
+// every chunk of the grid is compressed on its own: the cells in row order (inside the chunk) cut
+// into runs of one material and color, with the colors looked up in a palette of the colors the
+// chunk uses. a settled pile or a sky of empty cells comes out at a few bytes per chunk, and an
+// all-empty chunk takes none at all. the chunks are found through a table up front, each with
+// its own checksum, so a mapped file can check and decode any of them without reading the others.
+// loadWorld still decodes all of them at once: the engines and the renderer read the planes
+// directly, there's no first touch to hang a chunk's decode on
+//
+// the file is little endian
+//   "SANDWLD" version:u8 width:u32 height:u32 chunkSize:u32 tick:u32
+//   brushRandom: key:2xu32 stream:u64 block:u64 buffer:4xu32 used:u32
+//   table, per chunk (row by row): offset:u64 size:u32 checksum:u64
+//   checksum:u64 of everything before it
+//   chunk data, nothing for an empty chunk, otherwise encoding:u8 and then
+//     palette     paletteSize:varint colors:u32... and runs of material:u8 length:varint
+//                 paletteIndex:varint until the chunk's cells are covered
+//     raw colors  runs of material:u8 length:varint, then every cell's color:u32, for chunks
+//                 where the palette would cost more than the colors themselves
+const uint8_t WORLD_FILE_VERSION = 1;
+
+// an open world file, memory mapped. opening reads the header and checks the table, a chunk's
+// pages are only read when it's checked or decoded
+struct WorldFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    int width = 0, height = 0;
+    int chunkSize = 0;
+    int chunksX = 0, chunksY = 0;
+    unsigned tick = 0;
+    RandomStream brushRandom;
+#if defined(_WIN32)
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+// false if the grid couldn't be written out, or is more than MAX_GRID_SIDE a side
+bool saveWorld(const char* path);
+// replaces the world with the file's. every chunk is checked and decoded (in parallel, straight
+// out of the mapping) before the grid is touched, so a damaged file leaves the current world as
+// it was
+bool loadWorld(const char* path);
+
+bool openWorldFile(const char* path, WorldFile& file);
+void closeWorldFile(WorldFile& file);
+// whether the chunk's bytes match its checksum
+bool checkWorldChunk(const WorldFile& file, int chunk);
+// decodes one chunk into planes laid out like the grid's at the file's size, and adds its cells
+// to counts. false if the runs don't describe the chunk
+bool decodeWorldChunk(const WorldFile& file, int chunk, uint8_t* types, uint32_t* colors, size_t counts[MATERIAL_COUNT]);